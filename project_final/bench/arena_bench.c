@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "bpt.h"
+#include "file.h"
+
+// Arena benchmark : random frame accesses with and without BUF_FLAG_HUGE_PAGES.
+// Every frame is touched once, then read in random order. The AnonHugePages line
+// of /proc/self/smaps_rollup shows how much of the process is backed by huge pages.
+// Usage : arena_bench [num_buf]
+
+#define NUM_ROUNDS      20
+
+extern Buffer *buf_mgr;
+
+static double now(void){
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Print the huge page line of the process memory summary.
+static void print_huge_pages(void){
+    FILE *fp;
+    char line[256];
+
+    fp = fopen("/proc/self/smaps_rollup", "r");
+    if(fp == NULL){
+        printf("  smaps_rollup not available\n");
+        return;
+    }
+    while(fgets(line, sizeof(line), fp) != NULL){
+        if(strncmp(line, "AnonHugePages:", 14) == 0){
+            printf("  %s", line);
+        }
+    }
+    fclose(fp);
+}
+
+static void run(int num_buf, int flags, const int *order){
+    volatile long sum = 0;
+    double start, elapsed;
+    int round, i;
+
+    if(init_db_ex(num_buf, BUF_POLICY_CLOCK, flags) != 0){
+        printf("%s : init_db_ex failed\n", flags ? "huge pages" : "regular pages");
+        return;
+    }
+    for(i = 0; i < num_buf; i++){
+        buf_mgr[i].frame->bytes[0] = 1;
+    }
+
+    start = now();
+    for(round = 0; round < NUM_ROUNDS; round++){
+        for(i = 0; i < num_buf; i++){
+            sum += buf_mgr[order[i]].frame->bytes[(round * 64) % PAGE_SIZE];
+        }
+    }
+    elapsed = now() - start;
+
+    printf("%-13s : %.1f ns per random frame access\n", flags ? "huge pages" : "regular pages",
+            elapsed / ((double)NUM_ROUNDS * num_buf) * 1e9);
+    print_huge_pages();
+    shutdown_db();
+}
+
+// MAIN
+int main( int argc, char ** argv ) {
+    int num_buf, *order, i, j, tmp;
+
+    num_buf = argc > 1 ? atoi(argv[1]) : 100000;
+
+    order = malloc(num_buf * sizeof(int));
+    for(i = 0; i < num_buf; i++){
+        order[i] = i;
+    }
+    srand(3);
+    for(i = num_buf - 1; i > 0; i--){
+        j = rand() % (i + 1);
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    run(num_buf, 0, order);
+    run(num_buf, BUF_FLAG_HUGE_PAGES, order);
+    free(order);
+    return 0;
+}
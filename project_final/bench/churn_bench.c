@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bpt.h"
+#include "file.h"
+
+// Churn benchmark : throughput of each merge policy when small blocks of keys are
+// deleted and inserted again around the same spot, so nodes keep crossing the merge line.
+// Then 80% of the keys are deleted, and the background rebalancer is given idle
+// periods until no node is underfull or a period fixes none.
+// Usage : churn_bench [num_keys] [num_rounds] [num_buf]
+
+#define REBALANCE_BATCH     64
+#define IDLE_PERIOD_US      1000000
+#define MAX_IDLE_PERIODS    60
+// Fewest keys of a node under the eager merge policy
+#define LEAF_MIN_KEYS       (BPTREE_LEAF_ORDER / 2)
+#define INTERNAL_MIN_KEYS   ((BPTREE_INTERNAL_ORDER + 1) / 2 - 1)
+
+typedef struct _MergeSetting {
+    const char *name;
+    int policy;
+    int merge_percent;
+} MergeSetting;
+
+static const MergeSetting settings[] = {
+    { "eager", MERGE_POLICY_EAGER, 0 },
+    { "25%", MERGE_POLICY_THRESHOLD, 25 },
+    { "10%", MERGE_POLICY_THRESHOLD, 10 },
+    { "empty", MERGE_POLICY_EMPTY, 0 },
+};
+
+static double now(void){
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void value_of(uint64_t key, char *value){
+    memset(value, 0, SIZE_VALUE);
+    snprintf(value, SIZE_VALUE, "v%" PRIu64, key);
+}
+
+// Number of nodes under offset below the eager merge line, the root not counted.
+static int count_underfull(int table_id, off_t offset, int is_root){
+    NodePage node;
+    Page *frame;
+    int i, count = 0;
+
+    frame = buf_pin(table_id, offset);
+    if(frame == NULL){
+        return 0;
+    }
+    memcpy(&node, frame, sizeof(node));
+    buf_unpin(frame, 0);
+
+    if(node.is_leaf){
+        return !is_root && node.num_keys < LEAF_MIN_KEYS;
+    }
+    count = !is_root && node.num_keys < INTERNAL_MIN_KEYS;
+    for(i = 0; i <= node.num_keys; i++){
+        count += count_underfull(table_id, INTERNAL_OFFSET((InternalPage*)&node, i), 0);
+    }
+    return count;
+}
+
+static int table_underfull(int table_id){
+    if(dbheader[table_id - 1].root_offset == 0){
+        return 0;
+    }
+    return count_underfull(table_id, dbheader[table_id - 1].root_offset, 1);
+}
+
+static void run(const MergeSetting *setting, uint64_t num_keys, int num_rounds, int num_buf){
+    char value[SIZE_VALUE];
+    uint64_t key, base, ops = 0;
+    double start, elapsed;
+    int table_id, round, block, i, before, after, periods, last;
+
+    unlink("DATA1");
+    unlink("log.db");
+    init_db(num_buf);
+    table_id = open_table("DATA1");
+    set_merge_policy(setting->policy, setting->merge_percent);
+    for(key = 0; key < num_keys; key++){
+        value_of(key * 2, value);
+        insert(table_id, key * 2, value);
+    }
+
+    srand(3);
+    start = now();
+    for(round = 0; round < num_rounds; round++){
+        base = (num_keys / 2 + rand() % 64) * 2;
+        block = 8 + rand() % 16;
+        for(i = 0; i < block; i++){
+            delete(table_id, base + i * 2);
+            ops++;
+        }
+        for(i = 0; i < block; i++){
+            value_of(base + i * 2, value);
+            insert(table_id, base + i * 2, value);
+            ops++;
+        }
+    }
+    elapsed = now() - start;
+
+    // Case : mostly delete, lazy policies leave nodes underfull.
+    for(key = 0; key < num_keys; key++){
+        if(rand() % 10 < 8){
+            delete(table_id, key * 2);
+        }
+    }
+    // Nodes are counted with the rebalancer stopped : the count reads pages without the latch.
+    before = after = table_underfull(table_id);
+    periods = 0;
+    last = -1;
+    while(after > 0 && after != last && periods < MAX_IDLE_PERIODS){
+        last = after;
+        start_bg_rebalancer(REBALANCE_BATCH);
+        usleep(IDLE_PERIOD_US);
+        stop_bg_rebalancer();
+        periods++;
+        after = table_underfull(table_id);
+    }
+
+    printf("%-6s : %" PRIu64 " ops in %.2f s, %.2f Mops/s  underfull nodes %d -> %d after %d s idle\n",
+            setting->name, ops, elapsed, ops / elapsed / 1e6, before, after, periods);
+    close_table(table_id);
+    shutdown_db();
+    unlink("DATA1");
+}
+
+// MAIN
+int main( int argc, char ** argv ) {
+    uint64_t num_keys;
+    int num_rounds, num_buf;
+    unsigned i;
+
+    num_keys = argc > 1 ? strtoull(argv[1], NULL, 10) : 200000;
+    num_rounds = argc > 2 ? atoi(argv[2]) : 200000;
+    num_buf = argc > 3 ? atoi(argv[3]) : 1000;
+
+    for(i = 0; i < sizeof(settings) / sizeof(settings[0]); i++){
+        run(&settings[i], num_keys, num_rounds, num_buf);
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bpt.h"
+#include "file.h"
+
+// Cursor benchmark : short range scans through a cursor against one find per key,
+// and a full forward scan. Ranges alternate between forward and reverse cursors.
+// Keys are 10, 13, 16, ... so that the bounds also fall between keys.
+// Usage : cursor_bench [num_keys] [num_buf]
+
+#define NUM_RANGES      2000
+#define RANGE_KEYS      100
+
+typedef struct _KeySource {
+    uint64_t next;
+    uint64_t count;
+} KeySource;
+
+static double now(void){
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static uint64_t key_of(uint64_t i){
+    return 10 + 3 * i;
+}
+
+// Record source of bulk_load.
+static int next_record(void *arg, uint64_t *key, char *value){
+    KeySource *source = arg;
+
+    if(source->next >= source->count){
+        return 0;
+    }
+    *key = key_of(source->next);
+    memset(value, 0, SIZE_VALUE);
+    snprintf(value, SIZE_VALUE, "v%" PRIu64, *key);
+    source->next++;
+    return 1;
+}
+
+// MAIN
+int main( int argc, char ** argv ) {
+    KeySource source;
+    Cursor *cursor;
+    const char *value;
+    char *found;
+    uint64_t num_keys, key, lo;
+    long cursor_keys = 0, find_keys = 0, scan_keys = 0;
+    double start, cursor_time, find_time, scan_time;
+    int num_buf, table_id, i, j;
+
+    num_keys = argc > 1 ? strtoull(argv[1], NULL, 10) : 200000;
+    num_buf = argc > 2 ? atoi(argv[2]) : 200;
+
+    unlink("DATA1");
+    unlink("log.db");
+    init_db(num_buf);
+    table_id = open_table("DATA1");
+    source.next = 0;
+    source.count = num_keys;
+    if(bulk_load(table_id, next_record, &source, 70) != 0){
+        printf("cursor_bench : bulk_load failed\n");
+        return 1;
+    }
+
+    srand(5);
+    start = now();
+    for(i = 0; i < NUM_RANGES; i++){
+        lo = key_of(rand() % (num_keys - RANGE_KEYS));
+        cursor = cursor_open(table_id, lo, lo + 3 * (RANGE_KEYS - 1), i % 2 ? CURSOR_REVERSE : CURSOR_FORWARD);
+        while(cursor_next(cursor, &key, &value) == 1){
+            cursor_keys++;
+        }
+        cursor_close(cursor);
+    }
+    cursor_time = now() - start;
+
+    start = now();
+    for(i = 0; i < NUM_RANGES; i++){
+        lo = key_of(rand() % (num_keys - RANGE_KEYS));
+        for(j = 0; j < RANGE_KEYS; j++){
+            found = find(table_id, lo + 3 * j);
+            find_keys += found != NULL;
+            free(found);
+        }
+    }
+    find_time = now() - start;
+
+    start = now();
+    cursor = cursor_open(table_id, 0, UINT64_MAX, CURSOR_FORWARD);
+    while(cursor_next(cursor, &key, &value) == 1){
+        scan_keys++;
+    }
+    cursor_close(cursor);
+    scan_time = now() - start;
+
+    printf("%d ranges of %d keys : cursor %.2fM keys/s, find %.2fM keys/s\n",
+            NUM_RANGES, RANGE_KEYS, cursor_keys / cursor_time / 1e6, find_keys / find_time / 1e6);
+    printf("full scan of %ld keys : %.2fM keys/s\n", scan_keys, scan_keys / scan_time / 1e6);
+    if(cursor_keys != NUM_RANGES * RANGE_KEYS || find_keys != NUM_RANGES * RANGE_KEYS || scan_keys != (long)num_keys){
+        printf("cursor_bench : wrong number of keys\n");
+    }
+
+    close_table(table_id);
+    shutdown_db();
+    unlink("DATA1");
+    return 0;
+}
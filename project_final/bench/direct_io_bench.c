@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bpt.h"
+#include "file.h"
+
+// Direct I/O benchmark : buffered against BUF_FLAG_DIRECT_IO at several pool sizes.
+// num_keys inserts in scattered order, then num_keys random finds, on a fresh table.
+// Memory footprint after the finds : resident set of the process, and pages of the
+// data file held in the page cache (mmap and mincore, the file is not read).
+// Usage : direct_io_bench [num_keys]
+
+extern int dbfile[10];
+
+static const int pool_sizes[] = { 100, 1000, 5000 };
+
+static double now(void){
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Resident set of the process in kB, from /proc/self/status.
+static long resident_kb(void){
+    FILE *fp;
+    char line[256];
+    long kb = -1;
+
+    fp = fopen("/proc/self/status", "r");
+    if(fp == NULL){
+        return -1;
+    }
+    while(fgets(line, sizeof(line), fp) != NULL){
+        if(strncmp(line, "VmRSS:", 6) == 0){
+            kb = atol(line + 6);
+        }
+    }
+    fclose(fp);
+    return kb;
+}
+
+// Pages of the file in the page cache, -1 on failure.
+static long cached_pages(const char *pathname){
+    struct stat st;
+    unsigned char *vec;
+    void *map;
+    long page_size, num_pages, i, count = 0;
+    int fd;
+
+    fd = open(pathname, O_RDONLY);
+    if(fd < 0){
+        return -1;
+    }
+    if(fstat(fd, &st) != 0){
+        close(fd);
+        return -1;
+    }
+    if(st.st_size == 0){
+        close(fd);
+        return 0;
+    }
+    page_size = sysconf(_SC_PAGESIZE);
+    num_pages = (st.st_size + page_size - 1) / page_size;
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        return -1;
+    }
+    vec = malloc(num_pages);
+    if(vec != NULL && mincore(map, st.st_size, vec) == 0){
+        for(i = 0; i < num_pages; i++){
+            count += vec[i] & 1;
+        }
+    }
+    else{
+        count = -1;
+    }
+    free(vec);
+    munmap(map, st.st_size);
+    return count;
+}
+
+// Return 1 if the file descriptor was opened with O_DIRECT.
+static int opened_direct(int fd){
+    return (fcntl(fd, F_GETFL) & O_DIRECT) != 0;
+}
+
+static void run(int num_buf, int flags, uint64_t num_keys){
+    char value[SIZE_VALUE];
+    double start, insert_time, find_time;
+    uint64_t i;
+    int table_id;
+
+    unlink("DATA1");
+    unlink("log.db");
+    if(init_db_ex(num_buf, BUF_POLICY_CLOCK, flags) != 0){
+        printf("pool %5d : init_db_ex failed\n", num_buf);
+        return;
+    }
+    table_id = open_table("DATA1");
+
+    start = now();
+    for(i = 0; i < num_keys; i++){
+        memset(value, 0, SIZE_VALUE);
+        snprintf(value, SIZE_VALUE, "%" PRIu64, i);
+        insert(table_id, i * 2654435761u % num_keys, value);
+    }
+    insert_time = now() - start;
+
+    srand(1);
+    start = now();
+    for(i = 0; i < num_keys; i++){
+        free(find(table_id, rand() % num_keys));
+    }
+    find_time = now() - start;
+
+    printf("pool %5d %-8s : insert %5.2f s  find %5.2f s  VmRSS %7ld kB  DATA1 cached %7ld kB%s\n",
+            num_buf, flags ? "direct" : "buffered", insert_time, find_time, resident_kb(),
+            cached_pages("DATA1") * (sysconf(_SC_PAGESIZE) / 1024),
+            flags && !opened_direct(dbfile[table_id - 1]) ? "  (O_DIRECT refused, buffered)" : "");
+    shutdown_db();
+}
+
+// MAIN
+int main( int argc, char ** argv ) {
+    uint64_t num_keys;
+    unsigned i;
+
+    num_keys = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000;
+
+    for(i = 0; i < sizeof(pool_sizes) / sizeof(pool_sizes[0]); i++){
+        run(pool_sizes[i], 0, num_keys);
+        run(pool_sizes[i], BUF_FLAG_DIRECT_IO, num_keys);
+    }
+    unlink("DATA1");
+    return 0;
+}
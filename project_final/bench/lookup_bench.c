@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "bpt.h"
+#include "file.h"
+
+// Lookup benchmark : page table against a scan of buf_mgr, the lookup before the page table.
+// Every frame holds a page of one of three tables. Pages are probed in random order.
+// Usage : lookup_bench [max_frames]
+
+#define NUM_TABLES      3
+#define HASH_LOOKUPS    1000000
+// Scan lookups per size : about SCAN_WORK frame compares in total.
+#define SCAN_WORK       200000000LL
+
+extern Buffer *buf_mgr;
+extern int buf_size;
+
+static uint64_t rnd_state = 88172645463325252ULL;
+// Scan cursor, kept between calls like the old target_buf.
+static int scan_next = 0;
+
+static uint64_t rnd(void){
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+static double now(void){
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// The lookup before the page table : walk every frame from the scan cursor.
+static int scan_lookup(int table_id, off_t offset){
+    int i;
+
+    for(i = 0; i < buf_size; i++){
+        if(buf_mgr[scan_next].table_id == table_id && buf_mgr[scan_next].page_offset == offset){
+            buf_mgr[scan_next].refbit = 1;
+            return scan_next;
+        }
+        scan_next = (scan_next + 1) % buf_size;
+    }
+    return -1;
+}
+
+// Nanoseconds per lookup of count random pages, shifted past the resident ones for a miss.
+static double time_lookups(int num_buf, long count, int miss, int scan, long *found){
+    double start, elapsed;
+    off_t shift = miss ? (off_t)num_buf * PAGE_SIZE : 0;
+    int *table_ids, frame;
+    off_t *offsets;
+    long i;
+
+    table_ids = malloc(count * sizeof(int));
+    offsets = malloc(count * sizeof(off_t));
+    for(i = 0; i < count; i++){
+        frame = rnd() % num_buf;
+        table_ids[i] = 1 + frame % NUM_TABLES;
+        offsets[i] = (off_t)(frame / NUM_TABLES + 1) * PAGE_SIZE + shift;
+    }
+
+    start = now();
+    for(i = 0; i < count; i++){
+        if(scan){
+            *found += scan_lookup(table_ids[i], offsets[i]) >= 0;
+        }
+        else{
+            *found += page_table_lookup(table_ids[i], offsets[i]) >= 0;
+        }
+    }
+    elapsed = now() - start;
+
+    free(table_ids);
+    free(offsets);
+    return elapsed / count * 1e9;
+}
+
+static void run(int num_buf){
+    long scan_count, found = 0;
+    double scan_hit, scan_miss, hash_hit, hash_miss;
+    int i;
+
+    if(init_db(num_buf) != 0){
+        printf("%8d frames : init_db failed\n", num_buf);
+        return;
+    }
+    for(i = 0; i < num_buf; i++){
+        install_frame(i, 1 + i % NUM_TABLES, (off_t)(i / NUM_TABLES + 1) * PAGE_SIZE, 0);
+    }
+    scan_next = 0;
+
+    scan_count = SCAN_WORK / num_buf;
+    if(scan_count < 10){
+        scan_count = 10;
+    }
+    if(scan_count > HASH_LOOKUPS){
+        scan_count = HASH_LOOKUPS;
+    }
+    scan_hit = time_lookups(num_buf, scan_count, 0, 1, &found);
+    scan_miss = time_lookups(num_buf, scan_count, 1, 1, &found);
+    hash_hit = time_lookups(num_buf, HASH_LOOKUPS, 0, 0, &found);
+    hash_miss = time_lookups(num_buf, HASH_LOOKUPS, 1, 0, &found);
+
+    printf("%8d frames : scan hit %12.1f ns  scan miss %12.1f ns  hash hit %6.1f ns  hash miss %6.1f ns\n",
+            num_buf, scan_hit, scan_miss, hash_hit, hash_miss);
+    if(found != scan_count + HASH_LOOKUPS){
+        printf("lookup_bench : %ld pages found, expected %ld\n", found, scan_count + HASH_LOOKUPS);
+    }
+    shutdown_db();
+}
+
+// MAIN
+int main( int argc, char ** argv ) {
+    int num_buf, max_buf;
+
+    max_buf = argc > 1 ? atoi(argv[1]) : 1000000;
+    for(num_buf = 100; num_buf <= max_buf; num_buf *= 10){
+        run(num_buf);
+    }
+    return 0;
+}
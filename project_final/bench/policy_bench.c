@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include "bpt.h"
+#include "file.h"
+
+// Policy benchmark : hit ratio and hook cost of each replacement policy.
+// Workloads :
+//   insert : num_keys keys in random order, then num_keys / 2 keys into a second table.
+//   find   : num_keys lookups, 90% in a contiguous range of num_keys / 40 keys, the rest uniform.
+//            Every num_keys / 10 lookups, a sequential scan reads num_keys / 20 keys.
+//   join   : join_table of the two tables.
+// The policy hooks are wrapped to time them. Victim cost is the time in the victim and
+// remove hooks per eviction, timer overhead subtracted.
+// Usage : policy_bench [num_keys] [num_buf]
+
+static const char *policy_names[] = { "CLOCK", "LRU-K", "2Q", "ARC" };
+
+static int (*real_victim)(FILE *file);
+static void (*real_hit)(int buf_index);
+static void (*real_fill)(int buf_index);
+static void (*real_remove)(int buf_index, int evicted);
+
+// Seconds spent in the hooks, and number of calls
+static double victim_time, access_time;
+static uint64_t victim_calls, access_calls;
+// Cost of one pair of now() calls
+static double timer_overhead;
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+static uint64_t rnd(void){
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+static double now(void){
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Wrapped hooks */
+static int timed_victim(FILE *file){
+    double start = now();
+    int result = real_victim(file);
+
+    victim_time += now() - start;
+    victim_calls++;
+    return result;
+}
+static void timed_remove(int buf_index, int evicted){
+    double start = now();
+
+    real_remove(buf_index, evicted);
+    victim_time += now() - start;
+    victim_calls++;
+}
+static void timed_hit(int buf_index){
+    double start = now();
+
+    real_hit(buf_index);
+    access_time += now() - start;
+    access_calls++;
+}
+static void timed_fill(int buf_index){
+    double start = now();
+
+    real_fill(buf_index);
+    access_time += now() - start;
+    access_calls++;
+}
+
+static void wrap_policy(int policy){
+    ReplacementPolicy *hooks = get_replacement_policy(policy);
+
+    real_victim = hooks->victim;
+    real_hit = hooks->hit;
+    real_fill = hooks->fill;
+    real_remove = hooks->remove;
+    hooks->victim = timed_victim;
+    hooks->hit = timed_hit;
+    hooks->fill = timed_fill;
+    hooks->remove = timed_remove;
+}
+
+static void unwrap_policy(int policy){
+    ReplacementPolicy *hooks = get_replacement_policy(policy);
+
+    hooks->victim = real_victim;
+    hooks->hit = real_hit;
+    hooks->fill = real_fill;
+    hooks->remove = real_remove;
+}
+
+static void calibrate(void){
+    double start, total = 0;
+    int i;
+
+    for(i = 0; i < 1000000; i++){
+        start = now();
+        total += now() - start;
+    }
+    timer_overhead = total / 1000000;
+}
+
+// Print the counters of a workload and start the next one from zero.
+static void report(int policy, const char *workload, double wall){
+    BufferStats stats;
+    double victim_ns = 0, access_ns = 0;
+
+    get_buffer_stats(0, &stats);
+    if(stats.evictions > 0){
+        victim_ns = (victim_time - victim_calls * timer_overhead) / stats.evictions * 1e9;
+    }
+    if(access_calls > 0){
+        access_ns = (access_time - access_calls * timer_overhead) / access_calls * 1e9;
+    }
+    // Cheap hooks are below the timer resolution.
+    if(access_ns < 0){
+        access_ns = 0;
+    }
+    printf("%-6s %-6s : hit %6.2f%%  evictions %9" PRIu64 "  victim %5.0f ns/eviction  hook %4.0f ns/access  %6.2f s\n",
+            policy_names[policy], workload, 100.0 * stats.hits / (stats.hits + stats.misses),
+            stats.evictions, victim_ns, access_ns, wall);
+
+    victim_time = access_time = 0;
+    victim_calls = access_calls = 0;
+    reset_buffer_stats();
+}
+
+static void run(int policy, uint64_t num_keys, int num_buf){
+    char value[SIZE_VALUE] = "value";
+    uint64_t *keys, i, j, tmp, key, hot, scan, scan_end;
+    int table_1, table_2;
+    double start;
+
+    unlink("DATA1");
+    unlink("DATA2");
+    unlink("log.db");
+    unlink("join.txt");
+
+    wrap_policy(policy);
+    init_db_policy(num_buf, policy);
+    table_1 = open_table("DATA1");
+    table_2 = open_table("DATA2");
+
+    keys = malloc(num_keys * sizeof(uint64_t));
+    for(i = 0; i < num_keys; i++){
+        keys[i] = i;
+    }
+    for(i = num_keys - 1; i > 0; i--){
+        j = rnd() % (i + 1);
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+
+    reset_buffer_stats();
+    start = now();
+    for(i = 0; i < num_keys; i++){
+        insert(table_1, keys[i], value);
+    }
+    for(i = 0; i < num_keys / 2; i++){
+        insert(table_2, keys[i] * 2 % num_keys, value);
+    }
+    report(policy, "insert", now() - start);
+
+    hot = num_keys / 40;
+    start = now();
+    for(i = 0; i < num_keys; i++){
+        key = (rnd() % 10) ? rnd() % hot : rnd() % num_keys;
+        free(find(table_1, key));
+        // Case : sequential scan polluting the pool.
+        if(i % (num_keys / 10) == 0){
+            scan = (rnd() % num_keys) / 2;
+            for(scan_end = scan + num_keys / 20; scan < scan_end; scan++){
+                free(find(table_1, scan));
+            }
+        }
+    }
+    report(policy, "find", now() - start);
+
+    start = now();
+    join_table(table_1, table_2, "join.txt");
+    report(policy, "join", now() - start);
+
+    shutdown_db();
+    unwrap_policy(policy);
+    free(keys);
+    unlink("DATA1");
+    unlink("DATA2");
+    unlink("join.txt");
+}
+
+// MAIN
+int main( int argc, char ** argv ) {
+    uint64_t num_keys;
+    int num_buf, policy;
+
+    num_keys = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    num_buf = argc > 2 ? atoi(argv[2]) : 2000;
+
+    calibrate();
+    for(policy = BUF_POLICY_CLOCK; policy <= BUF_POLICY_ARC; policy++){
+        rnd_state = 88172645463325252ULL;
+        run(policy, num_keys, num_buf);
+    }
+    return 0;
+}
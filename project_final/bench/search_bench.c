@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "bpt.h"
+#include "file.h"
+
+// Search benchmark : random finds on a table held entirely in the buffer pool,
+// so the time goes to the descent and the node searches.
+// Each size is run NUM_RUNS times and the median rate is printed.
+// Only the public API and SIZE_VALUE are used : the driver also builds against older trees.
+// Usage : search_bench [num_finds]
+
+#define NUM_BUF         60000
+#define NUM_RUNS        6
+
+static const int table_sizes[] = { 3000, 200000 };
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+static uint64_t rnd(void){
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+static double now(void){
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int compare_double(const void *a, const void *b){
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+static void run(int num_keys, int num_finds){
+    char value[SIZE_VALUE] = "value";
+    double rates[NUM_RUNS], start;
+    char *found;
+    int table_id, i, r, hits;
+
+    unlink("DATA1");
+    unlink("log.db");
+    init_db(NUM_BUF);
+    table_id = open_table("DATA1");
+    // Keys are spread out so that finds land between keys of internal nodes.
+    for(i = 0; i < num_keys; i++){
+        insert(table_id, (uint64_t)i * 7, value);
+    }
+    // Warm up : bring every page into the pool.
+    for(i = 0; i < num_keys; i++){
+        free(find(table_id, (uint64_t)i * 7));
+    }
+
+    for(r = 0; r < NUM_RUNS; r++){
+        hits = 0;
+        start = now();
+        for(i = 0; i < num_finds; i++){
+            found = find(table_id, (rnd() % num_keys) * 7);
+            hits += found != NULL;
+            free(found);
+        }
+        rates[r] = num_finds / (now() - start);
+        if(hits != num_finds){
+            printf("%7d keys : %d of %d finds missed\n", num_keys, num_finds - hits, num_finds);
+        }
+    }
+    qsort(rates, NUM_RUNS, sizeof(double), compare_double);
+    printf("%7d keys : %.2fM lookups/s (median of %d runs of %d finds)\n", num_keys,
+            (rates[(NUM_RUNS - 1) / 2] + rates[NUM_RUNS / 2]) / 2 / 1e6, NUM_RUNS, num_finds);
+
+    close_table(table_id);
+    shutdown_db();
+    unlink("DATA1");
+}
+
+// MAIN
+int main( int argc, char ** argv ) {
+    int num_finds;
+    unsigned i;
+
+    num_finds = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    for(i = 0; i < sizeof(table_sizes) / sizeof(table_sizes[0]); i++){
+        run(table_sizes[i], num_finds);
+    }
+    return 0;
+}
@@ -9,11 +9,159 @@ int delete(int table_id, uint64_t key);
 void print_tree(int table_id);
 
 /* Project Buffer */
+// Page replacement policy : selected in init_db_policy
+#define BUF_POLICY_CLOCK            0
+#define BUF_POLICY_LRU_K            1
+#define BUF_POLICY_2Q               2
+#define BUF_POLICY_ARC              3
+
 // Function
 int init_db(int num_buf);
 
+int init_db_policy(int num_buf, int policy);
+
+// Buffer pool options : flags of init_db_ex
+#define BUF_FLAG_HUGE_PAGES         0x1     // Back the frames with huge pages if available
+#define BUF_FLAG_DIRECT_IO          0x2     // Open data files with O_DIRECT, bypassing the page cache
+
+int init_db_ex(int num_buf, int policy, int flags);
+
+// Grow or shrink the buffer pool to num_buf frames without restart.
+// Shrinking writes back and evicts pages of the removed frames.
+int resize_buffer(int num_buf);
+
 int close_table(int table_id);
 
 int shutdown_db();
 
+/* Background writer */
+// Write dirty pages in the background, keeping clean_percent of the buffer pool clean.
+// Batch is the maximum number of pages written per round.
+int start_bg_writer(int clean_percent, int batch);
+
+// Stop the background writer. Called by shutdown_db.
+int stop_bg_writer();
+
+/* Merge policy */
+// When delete merges an underfull node with a neighbor.
+#define MERGE_POLICY_EAGER          0       // Below half full (default)
+#define MERGE_POLICY_THRESHOLD      1       // Below merge_percent of a full node
+#define MERGE_POLICY_EMPTY          2       // Only when the node is empty : free-at-empty
+
+// Merge policy of every table. merge_percent (1 to 50) is used by MERGE_POLICY_THRESHOLD.
+int set_merge_policy(int policy, int merge_percent);
+
+/* Background rebalancer */
+// Compact the leaves left underfull by a lazy merge policy while the engine is idle.
+// Batch is the maximum number of leaves compacted per round.
+int start_bg_rebalancer(int batch);
+
+// Stop the background rebalancer. Called by shutdown_db.
+int stop_bg_rebalancer();
+
+/* Warm start */
+// Off by default. Keep the list of resident pages in pathname : shutdown_db writes it,
+// and pages on the list are preloaded when their table is opened by the next init_db.
+// NULL turns warm start off. Return 0 if success, -1 on failure.
+int set_warm_file(const char *pathname);
+
+// List the resident pages in the warm file for the next start. Called by shutdown_db.
+// Return -1 if no warm file is set.
+int dump_buffer_pool();
+
+/* Statistics */
+// Counters of the buffer manager since init_db, for the whole engine or one table.
+#define BUF_STATS_LATENCY_BUCKETS   20      // Bucket i : I/O took [2^(i-1), 2^i) us, last one longer
+
+typedef struct _BufferStats {
+    uint64_t hits;              // Page found in the buffer pool
+    uint64_t misses;            // Page not found in the buffer pool
+    uint64_t evictions;         // Page removed to reuse its frame
+    uint64_t dirty_evictions;   // Evicted page written back first
+    uint64_t clock_sweeps;      // Frames passed by the clock hand. Whole engine only.
+    uint64_t wal_flushes;       // Log flushes forced by page writes. Whole engine only.
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t read_latency[BUF_STATS_LATENCY_BUCKETS];
+    uint64_t write_latency[BUF_STATS_LATENCY_BUCKETS];
+} BufferStats;
+
+// Copy the counters of a table, or of the whole engine if table_id is 0.
+int get_buffer_stats(int table_id, BufferStats *stats);
+
+int reset_buffer_stats();
+
+// Write counters and buffer pool usage as JSON. Standard output if pathname is NULL.
+int dump_buffer_stats(const char *pathname);
+
+/* Bulk load */
+// Record source of bulk_load : fill key and value (SIZE_VALUE bytes) with the next record.
+// Return 1 for a record, 0 at the end of input, -1 to abort.
+typedef int (*BulkLoadIterator)(void *arg, uint64_t *key, char *value);
+
+// Build the tree of an empty table from records in strictly increasing key order.
+// Nodes are filled to fill_factor percent (1 to 100) : the rest is room for later inserts.
+int bulk_load(int table_id, BulkLoadIterator next, void *arg, int fill_factor);
+
+/* Batched lookup */
+// Look up n keys at once. The value of keys[i] is copied to values + i * SIZE_VALUE,
+// and found[i] (if not NULL) is set to 1, or 0 with a zeroed value if the key is missing.
+// Return the number of keys found, -1 on failure.
+int find_many(int table_id, const uint64_t *keys, int n, char *values, int *found);
+
+/* Batched insert */
+// Insert n records : keys[i] with the value at values + i * SIZE_VALUE.
+// Keys already in the table, or repeated in the batch, are skipped.
+// Return the number of records inserted, -1 on failure.
+int insert_batch(int table_id, const uint64_t *keys, const char *values, int n);
+
+/* Upsert */
+// Insert the record, or update the value if the key exists. One descent.
+// Updates are logged like update. Return 0 if success, -1 on failure.
+int upsert(int table_id, uint64_t key, const char *value);
+
+// Change a value in place : callback edits a copy of the value (SIZE_VALUE bytes)
+// and returns 0 to write it back, non-zero to leave the record as it is.
+// Callback must not change the table.
+typedef int (*ModifyCallback)(void *arg, uint64_t key, char *value);
+
+// Return 0 if success, -1 if the key is missing or callback refused.
+int modify(int table_id, uint64_t key, ModifyCallback callback, void *arg);
+
+/* Table statistics */
+// Kept in the header page and updated by every change of the tree.
+typedef struct _TableStats {
+    uint64_t num_keys;
+    uint64_t min_key;           // 0 for an empty table
+    uint64_t max_key;
+    uint64_t height;            // Levels of the tree, 1 for a single leaf
+    uint64_t num_leaves;
+    uint64_t num_internals;
+} TableStats;
+
+// Copy the statistics of a table. Return 0 if success, -1 on failure.
+int get_table_stats(int table_id, TableStats *stats);
+
+/* Range delete */
+// Delete the records with keys in [lo, hi]. Leaves and subtrees inside the range
+// are dropped without visiting their records. Return 0 if success, -1 on failure.
+int delete_range(int table_id, uint64_t lo, uint64_t hi);
+
+/* Cursor */
+// Range scan of the keys in [lo, hi], in increasing or decreasing key order.
+#define CURSOR_FORWARD              0
+#define CURSOR_REVERSE              1
+
+typedef struct _Cursor Cursor;
+
+// Descend once to the first record of the range. NULL on failure.
+Cursor* cursor_open(int table_id, uint64_t lo, uint64_t hi, int direction);
+
+// Move to the next record. key and value point into the pinned leaf,
+// valid until the next call. Return 1 for a record, 0 at the end of the range.
+// The table must not be changed while a cursor is open.
+int cursor_next(Cursor *cursor, uint64_t *key, const char **value);
+
+int cursor_close(Cursor *cursor);
+
 #endif // __BPT_H__
@@ -1,5 +1,6 @@
 #include <stddef.h>
 #include <inttypes.h>
+#include <sys/types.h>
 
 #define BPTREE_INTERNAL_ORDER       249 //4
 #define BPTREE_LEAF_ORDER           32  //4
@@ -63,12 +64,18 @@ typedef struct _HeaderPage {
     off_t root_offset;
     uint64_t num_pages;
     off_t page_lsn;
-    char reserved[PAGE_SIZE - 32];
+    uint64_t leaf_format;
+    uint64_t stats_magic;       // TABLE_STATS_MAGIC when stats match the tree
+    TableStats stats;
+    char reserved[PAGE_SIZE - 48 - sizeof(TableStats)];
 
     // in-memory data
     off_t file_offset;
 } HeaderPage;
 
+// Files written before the statistics have zeros here : they are counted on first use.
+#define TABLE_STATS_MAGIC           0x315354415453544cULL   // "LTSTATS1"
+
 #define INTERNAL_KEY(n, i)    ((n)->irecords[(i)+1].key)
 #define INTERNAL_OFFSET(n, i) ((n)->irecords[(i)].offset)
 typedef struct _InternalPage {
@@ -88,9 +95,38 @@ typedef struct _InternalPage {
     off_t file_offset;
 } InternalPage;
 
-#define LEAF_KEY(n, i)      ((n)->records[(i)].key)
-#define LEAF_VALUE(n, i)    ((n)->records[(i)].value)
+// Leaf format of a file, in HeaderPage.leaf_format
+// Files of LEAF_FORMAT_RECORDS are upgraded to LEAF_FORMAT_SOA by open_table.
+#define LEAF_FORMAT_RECORDS         0   // Record (key, value) array
+#define LEAF_FORMAT_SOA             1   // Key array, then value array
+// Set in every SoA leaf : an interrupted upgrade goes on where it stopped.
+#define LEAF_SOA_MAGIC              0x32464145414c5442ULL   // "BTLEAF2"
+
+#define LEAF_KEY(n, i)      ((n)->keys[(i)])
+#define LEAF_VALUE(n, i)    ((n)->values[(i)])
 typedef struct _LeafPage {
+    union {
+        struct {
+            off_t parent;
+            int is_leaf;
+            int num_keys;
+            uint64_t format;
+            off_t page_lsn;
+            char reserved_2[120 - 32];
+            off_t sibling;
+            // Keys on 4 cache lines : a search doesn't touch the values.
+            uint64_t keys[BPTREE_LEAF_ORDER-1];
+            char values[BPTREE_LEAF_ORDER-1][SIZE_VALUE];
+        };
+        char space[PAGE_SIZE];
+    };
+
+    // in-memory data
+    off_t file_offset;
+} LeafPage;
+
+// Leaf of LEAF_FORMAT_RECORDS files. Only read by the upgrade.
+typedef struct _RecordLeafPage {
     union {
         struct {
             off_t parent;
@@ -107,12 +143,12 @@ typedef struct _LeafPage {
 
     // in-memory data
     off_t file_offset;
-} LeafPage;
+} RecordLeafPage;
 
 typedef struct _NodePage {
     union {
         struct {
-            off_t parent;
+            off_t parent;       // Not used, written as 0 : parents come from the TreePath
             int is_leaf;
             int num_keys;
             char reserved_1[8];
@@ -125,6 +161,49 @@ typedef struct _NodePage {
     off_t file_offset;
 } NodePage;
 
+/* Traversal path */
+// Pages from the root down to a leaf, recorded by the descent of insert and delete.
+// A split or merge finds the parent in the path, so moved children are not rewritten.
+#define TREE_MAX_HEIGHT             32
+
+typedef struct _TreePath {
+    int height;                         // Pages in the path, the leaf is last
+    off_t offsets[TREE_MAX_HEIGHT];     // offsets[0] is the root
+    int indexes[TREE_MAX_HEIGHT];       // Child followed in each internal node
+    int rightmost;                      // Every internal node was left by its last child
+    uint64_t fence;                     // Not rightmost : keys of the leaf are below this separator
+} TreePath;
+
+// Descend to the leaf of key and record the path. Returns the pinned leaf, NULL for an empty tree.
+LeafPage* find_leaf_path(int table_id, uint64_t key, TreePath* path);
+
+/* Node search */
+// Keys of a node as an array : key i is keys[i * stride]. Search is in search.c.
+#define INTERNAL_KEYS(n)            (&(n)->irecords[1].key)
+#define INTERNAL_KEY_STRIDE         ((int)(sizeof(InternalRecord) / sizeof(uint64_t)))
+#define LEAF_KEYS(n)                ((n)->keys)
+#define LEAF_KEY_STRIDE             1
+
+// Index of the child to follow in an internal node
+#define INTERNAL_SEARCH(n, key)     search_upper(INTERNAL_KEYS(n), INTERNAL_KEY_STRIDE, (n)->num_keys, (key))
+// Index of the key in the node, -1 if not found
+#define INTERNAL_FIND(n, key)       search_key(INTERNAL_KEYS(n), INTERNAL_KEY_STRIDE, (n)->num_keys, (key))
+#define LEAF_FIND(n, key)           search_key(LEAF_KEYS(n), LEAF_KEY_STRIDE, (n)->num_keys, (key))
+// Insertion point of the key in a leaf
+#define LEAF_SEARCH(n, key)         search_lower(LEAF_KEYS(n), LEAF_KEY_STRIDE, (n)->num_keys, (key))
+
+// Choose the compare kernel of this CPU (AVX2, SSE4.2 or plain C). Called by init_db.
+void search_init(void);
+
+// Number of keys <= key
+int search_upper(const uint64_t *keys, int stride, int count, uint64_t key);
+
+// Number of keys < key
+int search_lower(const uint64_t *keys, int stride, int count, uint64_t key);
+
+// Index of the key, -1 if not found
+int search_key(const uint64_t *keys, int stride, int count, uint64_t key);
+
 /* Project Join */
 #define RESULT_KEY1(n, i)      ((n)->results[(i)].key1)
 #define RESULT_VALUE1(n, i)      ((n)->results[(i)].value1)
@@ -153,6 +232,9 @@ off_t get_free_page(int table_id);
 // Put free page to the free list
 void put_free_page(int table_id, off_t page_offset);
 
+// Put pages to the free list with one header write
+void put_free_pages(int table_id, const off_t *page_offsets, int count);
+
 // Expand file size and prepend pages to the free list
 void expand_file(int table_id, size_t cnt_page_to_expand);
 
@@ -162,6 +244,40 @@ void load_page(int table_id, off_t offset, Page* page);
 // Flush page into the file
 void flush_page(int table_id, Page* page);
 
+// Direct I/O mode of data files
+extern int direct_io;
+
+// Open a data file, with O_DIRECT in direct I/O mode
+int open_page_file(const char* filename, int flags, mode_t mode);
+
+/* Asynchronous page I/O */
+// Batches go through io_uring (uring.c), or load_page / flush_page without it.
+#define PAGE_IO_QUEUE_DEPTH         64
+
+typedef struct _PageIO {
+    int table_id;
+    off_t offset;       // Page to read. Writes use page->file_offset.
+    Page *page;
+} PageIO;
+
+// Read a batch of pages. Keeps up to PAGE_IO_QUEUE_DEPTH reads in flight.
+void load_pages(PageIO *ios, int count);
+
+// Write a batch of pages. Keeps up to PAGE_IO_QUEUE_DEPTH writes in flight.
+void flush_pages(PageIO *ios, int count);
+
+// Release the io_uring of the calling thread
+void page_io_destroy(void);
+
+// Checkpoint writes : pages are sorted by (table_id, page_offset), adjacent pages
+// are written with one pwritev and each file gets one fdatasync.
+#define WRITEBACK_MAX_RUN           64
+
+void writeback_pages(PageIO *ios, int count);
+
+// Ask the kernel to read pages ahead. Contiguous pages are merged into one request.
+void prefetch_pages(int table_id, off_t *offsets, int count);
+
 extern HeaderPage dbheader[10];
 
 /* Project Buffer */
@@ -173,8 +289,57 @@ typedef struct _Buffer{
     int is_dirty;
     // LRU clock structure
     int refbit;
+    // Page table chain : next buffer index in the same hash bucket
+    int hash_next;
+    // Number of callers working on the frame in place. Pinned frame is never evicted.
+    int pin_count;
+    // Id of the scan ring owning the frame, 0 if the frame belongs to the shared pool
+    int ring_id;
 } Buffer;
 
+// Frame arena is rounded to this size when huge pages are asked
+#define BUF_HUGE_PAGE_SIZE          (2 * 1024 * 1024)
+
+// Frames are mmap'ed in segments : resize_buffer adds a segment to grow,
+// so frames already in use never move.
+#define BUF_MAX_SEGMENTS            32
+
+typedef struct _FrameSegment {
+    Page *frames;
+    int first;          // Buffer index of the first frame
+    int count;          // Frames of the segment in use
+    size_t size;        // Bytes mapped
+} FrameSegment;
+
+/* Buffer access strategy */
+// Sequential scans recycle a small private ring of frames
+// instead of going through the replacement policy.
+#define BUF_RING_SIZE               16
+
+typedef struct _BufferRing {
+    int id;
+    int size;           // Maximum number of frames
+    int used;           // Frames acquired so far
+    int current;        // Next slot to recycle
+    int frames[BUF_RING_SIZE];
+} BufferRing;
+
+/* Read-ahead */
+// Leaf scans predict the next leaves from their parent page
+// and prefetch them before following the sibling chain.
+#define READAHEAD_MIN               4
+#define READAHEAD_MAX               64
+
+typedef struct _ReadAhead {
+    int table_id;
+    BufferRing *ring;   // Scan ring receiving the pages in direct I/O mode
+    int limit;          // Largest window
+    int window;         // Number of leaves predicted ahead of the scan
+    int count;          // Predicted leaves
+    int next;           // Index of the leaf expected next
+    off_t offsets[READAHEAD_MAX];
+} ReadAhead;
+
 // Load function
 void load_page_from_buffer(int table_id, off_t offset, Page* page);
 
@@ -186,9 +351,226 @@ int check_buffer_for_flush(int table_id, off_t offset);
 
 int replace_page(FILE *file);
 
+// Page table : hash directory of resident pages keyed on (table_id, page_offset)
+int page_table_lookup(int table_id, off_t offset);
+
+void page_table_insert(int buf_index);
+
+void page_table_remove(int buf_index);
+
+// Setting new buffer : register a loaded frame in the page table and the policy
+void install_frame(int buf_index, int table_id, off_t offset, int is_dirty);
+
+// Evict a frame without writing it back
+void clear_frame(int buf_index);
+
+// Move a frame of a scan ring to the shared pool
+void adopt_frame(int buf_index);
+
+// Pin a page in the buffer pool and return its frame. NULL if every frame is pinned.
+Page* buf_pin(int table_id, off_t offset);
+
+// Release a pinned frame. Set dirty if the frame was modified in place.
+void buf_unpin(Page* frame, int dirty);
+
+// Return buffer index if the page is a frame of the buffer pool, otherwise -1.
+int buf_frame_index(Page* page);
+
+// Scan ring : create before a sequential scan, free after it.
+void buf_ring_init(BufferRing *ring);
+
+// Pin a page for a sequential scan. Misses are loaded into the ring's frames.
+Page* buf_pin_ring(BufferRing *ring, int table_id, off_t offset);
+
+// Give the ring's frames back to the free frame list.
+void buf_ring_free(BufferRing *ring);
+
+// Load pages into the ring's frames with one batch of reads, without pinning them.
+// Returns the number of pages loaded.
+int buf_ring_prefetch(BufferRing *ring, int table_id, off_t *offsets, int count);
+
+// Load pages missing from the buffer pool with one batch of reads, without pinning them.
+// Returns the number of pages loaded.
+int buf_prefetch(int table_id, off_t *offsets, int count);
+
+// Read-ahead : create before a leaf scan, after the scan ring.
+void readahead_init(ReadAhead *ra, int table_id, BufferRing *ring);
+
+// Call before the scan moves from leaf to its sibling.
+void readahead_leaf(ReadAhead *ra, LeafPage *leaf);
+
 // Flush function
 void flush_page_to_buffer(int table_id, Page* page);
 
+/* Cursor */
+// The current leaf stays pinned between calls. Forward scans follow the siblings
+// with read-ahead; reverse scans move to the leaf on the left through the path.
+// Leaves after the first one go through a scan ring.
+struct _Cursor {
+    int table_id;
+    int direction;
+    uint64_t lo;
+    uint64_t hi;
+    LeafPage *leaf;     // NULL at the end of the range
+    int index;          // Next record of the leaf
+    TreePath path;      // Reverse : pages above the leaf
+    BufferRing ring;
+    ReadAhead ra;
+};
+
+/* Background writer */
+// Keeps part of the buffer pool clean so evictions find clean victims.
+#define BG_WRITER_INTERVAL          10  // ms between rounds
+#define BG_WRITER_MAX_BATCH         64
+
+// Engine latch : public functions run one at a time with the writer.
+void engine_lock(void);
+
+void engine_unlock(void);
+
+// Wait for the pages being written by the background writer.
+void wait_bg_writer(void);
+
+/* Background rebalancer */
+// Compacts the leaves left underfull by a lazy merge policy when no call
+// has taken the engine latch for a whole interval.
+#define BG_REBALANCER_INTERVAL      50      // ms between rounds
+#define REBALANCE_QUEUE_SIZE        1024    // Leaves waiting, later ones are dropped
+
+// An underfull leaf, found again by a key it holds.
+typedef struct _RebalanceEntry {
+    int table_id;
+    uint64_t key;
+    off_t leaf_offset;
+} RebalanceEntry;
+
+/* Warm start */
+// Once set_warm_file names a list, resident pages are listed there at shutdown_db (and by
+// the background writer every WARM_DUMP_INTERVAL seconds), then preloaded when their table
+// is opened. Entries name the data file by device and inode : a table id only names a slot.
+#define WARM_MAGIC                  0x324d524157545042ULL   // "BPTWARM2"
+#define WARM_DUMP_INTERVAL          60  // s
+
+typedef struct _WarmHeader {
+    uint64_t magic;
+    int64_t count;
+} WarmHeader;
+
+typedef struct _WarmEntry {
+    uint64_t dev;               // Data file : 0 once the entry is used
+    uint64_t ino;
+    int refbit;
+    off_t page_offset;
+} WarmEntry;
+
+// Time spent preloading pages in open_table (us) and number of pages preloaded
+extern uint64_t warm_time_us;
+extern uint64_t warm_loaded_pages;
+
+/* Statistics */
+// buf_stats[0] is the whole engine, buf_stats[table_id] one table.
+// Counters are added atomically : the background writer does I/O without the engine latch.
+#define STATS_MAX_TABLE             10      // Table ids are 1 to STATS_MAX_TABLE
+
+extern BufferStats buf_stats[STATS_MAX_TABLE + 1];
+
+#define STATS_ADD(table_id, field, n) do { \
+    if((table_id) >= 0){ \
+        __atomic_fetch_add(&buf_stats[0].field, (n), __ATOMIC_RELAXED); \
+        if((table_id) > 0){ \
+            __atomic_fetch_add(&buf_stats[table_id].field, (n), __ATOMIC_RELAXED); \
+        } \
+    } \
+} while(0)
+
+// Monotonic clock (ns) to time an I/O
+uint64_t stats_clock(void);
+
+// Count one I/O request of the table started at stats_clock() time start.
+void stats_io(int table_id, int write, size_t bytes, uint64_t start);
+
+/* Bulk load */
+// bulk_load builds the tree bottom-up : pages are taken from the end of the file
+// in order and written in batches, bypassing the buffer pool.
+#define BULK_LOAD_BATCH             256     // Pages per write batch
+
+// Last two nodes of a level. prev is full but not yet added to the level above :
+// when the input ends, prev and node are balanced so neither is left near empty.
+// Internal nodes keep the first key under child 0 in irecords[0].key until written.
+typedef struct _BulkLevel {
+    Page pages[2];
+    NodePage *node;     // Node being filled, NULL before the level has one
+    NodePage *prev;     // NULL before the first node of the level is full
+    int children;       // Records of a leaf, children of an internal node
+    int prev_children;
+} BulkLevel;
+
+typedef struct _BulkLoad {
+    int table_id;
+    int leaf_capacity;          // Records per leaf
+    int internal_capacity;      // Children per internal node
+    int height;                 // Levels started, leaves are level 0
+    uint64_t num_nodes[2];      // Leaves and internal nodes started
+    BulkLevel levels[TREE_MAX_HEIGHT];
+    // Finished pages waiting to be written
+    Page *batch;
+    PageIO *ios;
+    int num_batch;
+} BulkLoad;
+
+/* Batched lookup */
+// find_many descends one level at a time for all keys : nodes of a level are visited
+// once, in key order, and the misses of a level are read together.
+#define FIND_MANY_BATCH             PAGE_IO_QUEUE_DEPTH     // Nodes read per batch
+
+// Key of a batch, sorted by key then position : the first of equal keys comes first.
+typedef struct _ManyKey {
+    uint64_t key;
+    int index;          // Position in the caller's arrays
+} ManyKey;
+
+/* Batched insert */
+// insert_batch merges the records of a leaf with one descent, and writes
+// at most this many leaves before descending again.
+#define INSERT_BATCH_LEAVES         16
+
+/* Range delete */
+// State of delete_range while it walks down the tree.
+typedef struct _RangeDelete {
+    int table_id;
+    uint64_t lo;
+    uint64_t hi;
+    int leaf_level;     // Level of the leaves, the root is level 0
+    off_t *freed;       // Pages of the removed nodes, freed in one batch at the end
+    int num_freed;
+    int max_freed;
+    int freed_leaves;
+    uint64_t deleted;   // Records removed
+    int uncounted;      // A dropped leaf was not in the buffer pool : deleted is short
+} RangeDelete;
+
+/* Buffer replacement policy */
+// Hooks called by the buffer manager. Policies are in policy.c.
+typedef struct _ReplacementPolicy {
+    const char *name;
+    // Set up for num_buf frames, none of them filled. On failure the current state is kept.
+    int (*init)(int num_buf);
+    void (*destroy)(void);
+    // Page found in its frame
+    void (*hit)(int buf_index);
+    // Page placed in a frame : table_id and page_offset are already set
+    void (*fill)(int buf_index);
+    // Frame leaves the pool. evicted is 1 when it was chosen as victim.
+    void (*remove)(int buf_index, int evicted);
+    // Choose a frame to evict, -1 if no frame can be evicted
+    int (*victim)(FILE *file);
+} ReplacementPolicy;
+
+ReplacementPolicy* get_replacement_policy(int policy);
+
+// Return 1 if the frame holds a page which can be evicted now.
+int frame_evictable(int buf_index, FILE *file);
+
 /* Project Join */
 int join_table(int table_id_1, int table_id_2, char *pathname);
 
@@ -202,6 +584,8 @@ void flush_output_page(FILE *file, Page *page);
 
 void sync_buffer(FILE *file);
 
+void write_output_rows(FILE *file, OutputPage *output);
+
 /* Project recovery */
 typedef struct _LogRecord{
     struct{
@@ -248,6 +632,6 @@ void recovery();
 
 void execute_wal(int page_lsn);
 
-int exclude_header();
+int exclude_header(int buf_index);
 
-int exclude_internal();
+int exclude_internal(int buf_index);
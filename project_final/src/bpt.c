@@ -63,6 +63,10 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "bpt.h"
 #include "file.h"
 #ifdef WINDOWS
@@ -113,11 +117,89 @@ int order_leaf = BPTREE_LEAF_ORDER;
  */
 bool verbose_output = false;
 
+/* Appends : GLOBALS */
+// Rightmost leaf of each table, 0 if not known. Keys past its largest key
+// go there without a descent. Checked on use : only the rightmost leaf has no sibling.
+static off_t rightmost_leaf[10];
+
+/* Table statistics : GLOBALS */
+// Statistics changed in dbheader since the header frame was last updated.
+static int stats_dirty[10];
+
+/* Merge policy : GLOBALS */
+// When delete merges an underfull node. Set by set_merge_policy.
+static int merge_policy = MERGE_POLICY_EAGER;
+static int merge_percent = 50;
+
 /* Project Buffer : GLOBALS */
 Buffer *buf_mgr;
+FrameSegment buf_segments[BUF_MAX_SEGMENTS];
+int num_buf_segments = 0;
+int buf_flags = 0;
 int buf_size = -1;
 int clock_hand = 0;
-int target_buf = 0;
+
+// Page table : bucket heads of buffer index chains.
+int *page_table;
+int page_table_mask = 0;
+
+// Replacement policy and frames holding no page.
+ReplacementPolicy *buf_policy;
+int *free_frames;
+int num_free_frames = 0;
+
+// Last id given to a scan ring.
+int last_ring_id = 0;
+
+/* Background writer : GLOBALS */
+// Engine latch : held by every public function.
+// Public functions call each other : depth counts the nested locks of this thread.
+static pthread_mutex_t engine_latch = PTHREAD_MUTEX_INITIALIZER;
+static __thread int engine_depth = 0;
+
+static pthread_t bg_writer;
+static pthread_cond_t bg_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t bg_idle = PTHREAD_COND_INITIALIZER;
+static int bg_running = 0;
+static int bg_in_flight = 0;
+static int bg_clean_percent = 0;
+static int bg_batch_size = 0;
+
+// Copies of the batch : written without the engine latch.
+static Page bg_pages[BG_WRITER_MAX_BATCH];
+static PageIO bg_ios[BG_WRITER_MAX_BATCH];
+static int bg_frames[BG_WRITER_MAX_BATCH];
+
+// Times the engine latch was taken : the engine is idle while it stays the same.
+static uint64_t engine_ops = 0;
+
+/* Background rebalancer : GLOBALS */
+static pthread_t bg_rebalancer;
+static pthread_cond_t rb_wake = PTHREAD_COND_INITIALIZER;
+static int rb_running = 0;
+static int rb_batch_size = 0;
+
+// Leaves left underfull by the merge policy, compacted when the engine is idle.
+static RebalanceEntry rb_queue[REBALANCE_QUEUE_SIZE];
+static int rb_head = 0;
+static int rb_count = 0;
+// Queue overflowed : walk every leaf of the table from rb_sweep_key instead.
+static int rb_sweep[10];
+static uint64_t rb_sweep_key[10];
+
+// Cursors open : pages under a cursor must not move, so the rebalancer waits.
+int open_cursors = 0;
+
+/* Warm start : GLOBALS */
+// Pages resident at the last dump, waiting for their table to be opened.
+// List file of warm start, NULL if off.
+static char *warm_file = NULL;
+static WarmEntry *warm_pages = NULL;
+static int num_warm_pages = 0;
+static time_t last_warm_dump = 0;
+// Time spent preloading pages in open_table, and pages preloaded.
+uint64_t warm_time_us = 0;
+uint64_t warm_loaded_pages = 0;
 
 /* Project Recovery : GLOBALS */
 // Log buffer about 8 MB / LogRecord size : 280 Bytes.
@@ -128,6 +210,10 @@ static uint64_t xid = 0;
 static uint64_t lsn = SIZE_LOG;
 static int log = -1;
 static int log_hand = 0;
+// Set between begin_transaction and its commit or abort : the log is still needed to roll back.
+static int in_transaction = 0;
+// Set during recovery : log records address leaves in the layout they were written with.
+static int recovering = 0;
 
 // FUNCTION PROTOTYPES.
 
@@ -139,26 +225,57 @@ void usage_1( void );
 void usage_2( void );
 void find_and_print(int table_id, uint64_t key); 
 bool find_leaf(int table_id, uint64_t key, LeafPage* out_leaf_node);
+LeafPage* find_leaf_pinned(int table_id, uint64_t key);
+static LeafPage* find_rightmost_pinned(int table_id, uint64_t key);
+
+// Table statistics.
+static void stats_add_keys(int table_id, uint64_t count, uint64_t min_key, uint64_t max_key);
+static void stats_remove_keys(int table_id, uint64_t count);
+static void stats_remove_key(int table_id, uint64_t key);
+static void stats_add_pages(int table_id, int leaves, int internals, int height);
+static void stats_refresh_bounds(int table_id);
+static void stats_flush_all(void);
 
 // Insertion.
 void start_new_tree(int table_id, uint64_t key, const char* value);
-void insert_into_leaf(int talbe_id, LeafPage* leaf_node, uint64_t key, const char* value);
-void insert_into_leaf_after_splitting(int table_id, LeafPage* leaf_node, uint64_t key, const char* value);
-void insert_into_parent(int table_id, NodePage* left, uint64_t key, NodePage* right);
+void insert_into_leaf(LeafPage* leaf_node, uint64_t key, const char* value);
+void insert_into_leaf_after_splitting(int table_id, TreePath* path, LeafPage* leaf_node, uint64_t key, const char* value);
+void insert_into_parent(int table_id, TreePath* path, int level, NodePage* left, uint64_t key, NodePage* right);
 void insert_into_new_root(int table_id, NodePage* left, uint64_t key, NodePage* right);
-int get_left_index(InternalPage* parent, off_t left_offset);
 void insert_into_node(InternalPage * parent, int left_index, uint64_t key, off_t right_offset);
-void insert_into_node_after_splitting(int table_id, InternalPage* parent, int left_index, uint64_t key, off_t right_offset);
+void insert_into_node_after_splitting(int table_id, TreePath* path, int level, InternalPage* parent, int left_index, uint64_t key, off_t right_offset);
 
 // Deletion.
-int get_neighbor_index(int table_id, NodePage* node_page);
+int get_neighbor_index(TreePath* path, int level);
 void adjust_root(int table_id);
-void coalesce_nodes(int table_id, NodePage* node_page, NodePage* neighbor_page,
-                      int neighbor_index, int k_prime);
-void redistribute_nodes(int table_id, NodePage* node_page, NodePage* neighbor_page,
+void coalesce_nodes(int table_id, TreePath* path, int level, NodePage* node_page, NodePage* neighbor_page,
+                      int neighbor_index, uint64_t k_prime);
+void redistribute_nodes(int table_id, off_t parent_offset, NodePage* node_page, NodePage* neighbor_page,
                           int neighbor_index,
-                          int k_prime_index, int k_prime);
-void delete_entry(int table_id, NodePage* node_page, uint64_t key);
+                          int k_prime_index, uint64_t k_prime);
+void rebalance_node(int table_id, TreePath* path, int level, NodePage* node_page);
+static int merge_min_keys(NodePage* node_page, int eager);
+static void rebalance_path(int table_id, uint64_t key, int eager);
+static void rebalance_queue_push(int table_id, uint64_t key, off_t leaf_offset);
+void delete_entry(int table_id, TreePath* path, int level, NodePage* node_page, uint64_t key);
+
+// Range delete.
+static int delete_range_node(RangeDelete *rd, off_t offset, int level, uint64_t node_lo, uint64_t node_hi);
+
+// Warm start.
+static int warm_file_id(int table_id, uint64_t *dev, uint64_t *ino);
+static void load_warm_list(void);
+static void warm_table(int table_id);
+
+// Leaf format upgrade.
+static void upgrade_leaf_format(int table_id);
+
+// Recovery.
+static void checkpoint_log(void);
+
+// Bulk load.
+static int bulk_next_node(BulkLoad *bulk, int level);
+static int bulk_push(BulkLoad *bulk, int level, NodePage *child);
 
 
 // FUNCTION DEFINITIONS.
@@ -253,6 +370,8 @@ int open_table(const char* filename) {
     int i, table_id;
     size_t len;
 
+    engine_lock();
+
     len = strlen(filename);
 
     if((int)len == 5){
@@ -265,15 +384,17 @@ int open_table(const char* filename) {
     else{
         // Irregular case.
         printf("Wrong input!\n");
+        engine_unlock();
         return -1;
     }
 
-    dbfile[i] = open(filename, O_RDWR);
+    dbfile[i] = open_page_file(filename, O_RDWR, 0);
     if (dbfile[i] < 0) {
         // Create a new db file
-        dbfile[i] = open(filename, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR);
+        dbfile[i] = open_page_file(filename, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR);
         if (dbfile[i] < 0) {
             assert("failed to create new db file");
+            engine_unlock();
             return -1;
         }
         
@@ -283,6 +404,8 @@ int open_table(const char* filename) {
         dbheader[i].num_pages = 1;
         dbheader[i].file_offset = 0;
         dbheader[i].page_lsn = -1;
+        dbheader[i].leaf_format = LEAF_FORMAT_SOA;
+        dbheader[i].stats_magic = TABLE_STATS_MAGIC;
         flush_page_to_buffer(i+1, (Page*)(dbheader + i));
     } else {
         // DB file exist. Load header info
@@ -296,6 +419,18 @@ int open_table(const char* filename) {
         dbheader[i].file_offset = 0;
     }
 
+    rightmost_leaf[i] = 0;
+
+    // Leaves of an older file : convert them before the tree is used.
+    // Recovery converts the tables it opens once the log is applied.
+    if(!recovering){
+        upgrade_leaf_format(i+1);
+    }
+
+    // Bring back the pages of the table resident before the last shutdown.
+    warm_table(i+1);
+
+    engine_unlock();
     return i+1;
 }
 
@@ -324,8 +459,11 @@ void print_tree(int table_id) {
     int front = 0;
     int rear = 0;
 
+    engine_lock();
+
     if (dbheader[table_id - 1].root_offset == 0) {
 		printf("Empty tree.\n");
+        engine_unlock();
         return;
     }
 
@@ -370,6 +508,8 @@ void print_tree(int table_id) {
             printf("| ");
         }
     }
+
+    engine_unlock();
 }
 
 /* Finds the record under a given key and prints an
@@ -393,31 +533,112 @@ void find_and_print(int table_id, uint64_t key) {
  * Returns the leaf containing the given key.
  */
 bool find_leaf(int table_id, uint64_t key, LeafPage* out_leaf_node) {
-    int i = 0;
+    LeafPage* leaf_node;
+
+    leaf_node = find_leaf_pinned(table_id, key);
+	if (leaf_node == NULL) {
+		return false;
+	}
+
+    memcpy(out_leaf_node, leaf_node, sizeof(LeafPage));
+    buf_unpin((Page*)leaf_node, 0);
+
+	return true;
+}
+
+/* Same as find_leaf, but works on the buffer frames in place.
+ * Only one page is pinned at a time while descending.
+ * Returns the pinned leaf frame, NULL for an empty tree.
+ * Caller must release it with buf_unpin.
+ */
+LeafPage* find_leaf_pinned(int table_id, uint64_t key) {
+    return find_leaf_path(table_id, key, NULL);
+}
+
+/* Same as find_leaf_pinned, and records the pages
+ * of the descent in path (if not NULL) :
+ * insert and delete find the parents of a node there.
+ */
+LeafPage* find_leaf_path(int table_id, uint64_t key, TreePath* path) {
+    int i = 0, height = 0, rightmost = 1;
     off_t root_offset = dbheader[table_id - 1].root_offset;
+    off_t child_offset;
+    NodePage* page;
 
 	if (root_offset == 0) {
-		return false;
+		return NULL;
 	}
     
-    NodePage page;
-    load_page_from_buffer(table_id, root_offset, (Page*)&page);
+    page = (NodePage*)buf_pin(table_id, root_offset);
+    if (page == NULL) {
+        return NULL;
+    }
 
-	while (!page.is_leaf) {
-        InternalPage* internal_node = (InternalPage*)&page;
+	while (!page->is_leaf) {
+        InternalPage* internal_node = (InternalPage*)page;
 
-        i = 0;
-		while (i < internal_node->num_keys) {
-			if (key >= INTERNAL_KEY(internal_node, i)) i++;
-			else break;
-		}
+        i = INTERNAL_SEARCH(internal_node, key);
         
-        load_page_from_buffer(table_id, INTERNAL_OFFSET(internal_node, i), (Page*)&page);
+        child_offset = INTERNAL_OFFSET(internal_node, i);
+        if (path != NULL) {
+            // Case : tree is higher than a path can hold.
+            if (height == TREE_MAX_HEIGHT - 1) {
+                buf_unpin((Page*)page, 0);
+                return NULL;
+            }
+            path->offsets[height] = page->file_offset;
+            path->indexes[height] = i;
+            height++;
+            rightmost = rightmost && i == internal_node->num_keys;
+            // Deeper separators are closer to the key.
+            if (i < internal_node->num_keys) {
+                path->fence = INTERNAL_KEY(internal_node, i);
+            }
+        }
+        buf_unpin((Page*)page, 0);
+
+        page = (NodePage*)buf_pin(table_id, child_offset);
+        if (page == NULL) {
+            return NULL;
+        }
 	}
 
-    memcpy(out_leaf_node, &page, sizeof(LeafPage));
+    if (path != NULL) {
+        path->offsets[height] = page->file_offset;
+        path->indexes[height] = -1;
+        path->height = height + 1;
+        path->rightmost = rightmost;
+    }
+
+	return (LeafPage*)page;
+}
 
-	return true;
+/* Returns the pinned rightmost leaf if key is past
+ * the largest key of the tree, otherwise NULL.
+ * The cached leaf is checked : the page may have been
+ * split, freed or reused since.
+ */
+static LeafPage* find_rightmost_pinned(int table_id, uint64_t key) {
+    off_t offset = rightmost_leaf[table_id - 1];
+    LeafPage* leaf_node;
+
+    if (offset == 0) {
+        return NULL;
+    }
+
+    leaf_node = (LeafPage*)buf_pin(table_id, offset);
+    if (leaf_node == NULL) {
+        return NULL;
+    }
+
+    // Case : not the rightmost leaf anymore, or key is not an append.
+    if (!leaf_node->is_leaf || leaf_node->sibling != 0 || leaf_node->num_keys == 0 ||
+            LEAF_KEY(leaf_node, leaf_node->num_keys - 1) >= key) {
+        buf_unpin((Page*)leaf_node, 0);
+        return NULL;
+    }
+
+	return leaf_node;
 }
 
 /* Finds and returns the record to which
@@ -426,22 +647,183 @@ bool find_leaf(int table_id, uint64_t key, LeafPage* out_leaf_node) {
 // If you want to return a record, use 3rd parameter
 char* find(int table_id, uint64_t key) {
     int i = 0;
-    char* out_value;
+    char* out_value = NULL;
 
-    LeafPage leaf_node;
-    if (!find_leaf(table_id, key, &leaf_node)) {
+    engine_lock();
+
+    LeafPage* leaf_node = find_leaf_pinned(table_id, key);
+    if (leaf_node == NULL) {
+        engine_unlock();
         return NULL;
     }
 
-	for (i = 0; i < leaf_node.num_keys; i++) {
-		if (LEAF_KEY(&leaf_node, i) == key) {
-            out_value = (char*)malloc(SIZE_VALUE * sizeof(char));
-            memcpy(out_value, LEAF_VALUE(&leaf_node, i), SIZE_VALUE);
-            return out_value;
+    i = LEAF_FIND(leaf_node, key);
+    if (i != -1) {
+        out_value = (char*)malloc(SIZE_VALUE * sizeof(char));
+        memcpy(out_value, LEAF_VALUE(leaf_node, i), SIZE_VALUE);
+    }
+
+    buf_unpin((Page*)leaf_node, 0);
+
+    engine_unlock();
+    return out_value;
+}
+
+/* Batched lookup */
+static int compare_many_key(const void *a, const void *b){
+    const ManyKey *x = (const ManyKey*)a, *y = (const ManyKey*)b;
+
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return x->index - y->index;
+}
+
+/* Finds the records of n keys at once.
+ * Keys are sorted and go down the tree together : each level is
+ * a list of nodes with the first sorted key that reaches them.
+ * Nodes are pinned once per level, not once per key,
+ * and the nodes missing from the buffer pool are read in batches.
+ */
+int find_many(int table_id, const uint64_t *keys, int n, char *values, int *found) {
+    ManyKey* sorted = NULL;
+    off_t *offsets = NULL, *next_offsets = NULL, *swap_offsets, child;
+    int *firsts = NULL, *next_firsts = NULL, *swap_firsts;
+    int i, j, k, end, batch, scan = 0, num_nodes, num_next, result = 0;
+    NodePage* page;
+    BufferRing ring;
+
+    engine_lock();
+
+    // Failure case
+    if (table_id < 1 || table_id > 10 || buf_size == -1 || buf_mgr == NULL || dbfile[table_id - 1] <= 0 ||
+            n < 0 || (n > 0 && (keys == NULL || values == NULL))) {
+        engine_unlock();
+        return -1;
+    }
+
+    // Every key starts as missing.
+    for (i = 0; i < n; i++) {
+        memset(values + (size_t)i * SIZE_VALUE, 0, SIZE_VALUE);
+        if (found != NULL) {
+            found[i] = 0;
         }
     }
 
-    return NULL;
+    // Case : nothing to find.
+    if (n == 0 || dbheader[table_id - 1].root_offset == 0) {
+        engine_unlock();
+        return 0;
+    }
+
+    sorted = (ManyKey*)malloc(n * sizeof(ManyKey));
+    offsets = (off_t*)malloc(n * sizeof(off_t));
+    next_offsets = (off_t*)malloc(n * sizeof(off_t));
+    firsts = (int*)malloc(n * sizeof(int));
+    next_firsts = (int*)malloc(n * sizeof(int));
+    if (sorted == NULL || offsets == NULL || next_offsets == NULL || firsts == NULL || next_firsts == NULL) {
+        num_nodes = 0;
+        result = -1;
+    }
+    else {
+        for (i = 0; i < n; i++) {
+            sorted[i].key = keys[i];
+            sorted[i].index = i;
+        }
+        qsort(sorted, n, sizeof(ManyKey), compare_many_key);
+
+        offsets[0] = dbheader[table_id - 1].root_offset;
+        firsts[0] = 0;
+        num_nodes = 1;
+    }
+
+    // Keep most of a small buffer pool for the nodes being read.
+    batch = buf_size / 4 < FIND_MANY_BATCH ? buf_size / 4 : FIND_MANY_BATCH;
+    if (batch < 1) {
+        batch = 1;
+    }
+    buf_ring_init(&ring);
+
+    while (num_nodes > 0) {
+        num_next = 0;
+
+        for (i = 0; i < num_nodes; i++) {
+            // First node of the level : tells if the level is the leaves.
+            // Too many leaves to keep would push the internal nodes out of the pool :
+            // they go through the scan ring, as in a scan.
+            if (i == 0) {
+                page = (NodePage*)buf_pin(table_id, offsets[i]);
+                scan = page != NULL && page->is_leaf && num_nodes > buf_size / 4;
+            }
+            else if (scan) {
+                if ((i - 1) % ring.size == 0) {
+                    buf_ring_prefetch(&ring, table_id, offsets + i, num_nodes - i);
+                }
+                page = (NodePage*)buf_pin_ring(&ring, table_id, offsets[i]);
+            }
+            else {
+                if ((i - 1) % batch == 0) {
+                    buf_prefetch(table_id, offsets + i, num_nodes - i < batch ? num_nodes - i : batch);
+                }
+                page = (NodePage*)buf_pin(table_id, offsets[i]);
+            }
+
+            // Case : every frame is pinned.
+            if (page == NULL) {
+                result = -1;
+                break;
+            }
+
+            // Keys of this node : up to the first key of the next one.
+            end = i + 1 < num_nodes ? firsts[i + 1] : n;
+
+            // Case : leaf. Copy the records found.
+            if (page->is_leaf) {
+                for (k = firsts[i]; k < end; k++) {
+                    j = LEAF_FIND((LeafPage*)page, sorted[k].key);
+                    if (j == -1) {
+                        continue;
+                    }
+                    memcpy(values + (size_t)sorted[k].index * SIZE_VALUE, LEAF_VALUE((LeafPage*)page, j), SIZE_VALUE);
+                    if (found != NULL) {
+                        found[sorted[k].index] = 1;
+                    }
+                    result++;
+                }
+            }
+            // Case : internal node. Children of the next level, in key order.
+            else {
+                for (k = firsts[i]; k < end; k++) {
+                    child = INTERNAL_OFFSET((InternalPage*)page, INTERNAL_SEARCH((InternalPage*)page, sorted[k].key));
+                    if (num_next == 0 || next_offsets[num_next - 1] != child) {
+                        next_offsets[num_next] = child;
+                        next_firsts[num_next] = k;
+                        num_next++;
+                    }
+                }
+            }
+
+            buf_unpin((Page*)page, 0);
+        }
+
+        swap_offsets = offsets;
+        offsets = next_offsets;
+        next_offsets = swap_offsets;
+        swap_firsts = firsts;
+        firsts = next_firsts;
+        next_firsts = swap_firsts;
+        num_nodes = result == -1 ? 0 : num_next;
+    }
+
+    buf_ring_free(&ring);
+    engine_unlock();
+
+    free(sorted);
+    free(offsets);
+    free(next_offsets);
+    free(firsts);
+    free(next_firsts);
+    return result;
 }
 
 /* Finds the appropriate place to
@@ -455,31 +837,16 @@ int cut( int length ) {
 }
 
 // INSERTION
-/* Helper function used in insert_into_parent
- * to find the index of the parent's pointer to 
- * the node to the left of the key to be inserted.
- */
-int get_left_index(InternalPage* parent, off_t left_offset) {
-
-	int left_index = 0;
-	while (left_index <= parent->num_keys && 
-			INTERNAL_OFFSET(parent, left_index) != left_offset)
-		left_index++;
-	return left_index;
-}
-
 /* Inserts a new pointer to a record and its corresponding
  * key into a leaf.
- * Returns the altered leaf.
+ * The leaf is modified in place : caller unpins
+ * the leaf frame as dirty.
  */
-void insert_into_leaf(int table_id, LeafPage* leaf_node, uint64_t key, const char* value) {
+void insert_into_leaf(LeafPage* leaf_node, uint64_t key, const char* value) {
 	int insertion_point;
     int i;
 
-	insertion_point = 0;
-	while (insertion_point < leaf_node->num_keys &&
-           LEAF_KEY(leaf_node, insertion_point) < key)
-		insertion_point++;
+	insertion_point = LEAF_SEARCH(leaf_node, key);
 
     // shift keys and values to the right
     for (i = leaf_node->num_keys - 1; i >= insertion_point; i--) {
@@ -490,9 +857,6 @@ void insert_into_leaf(int table_id, LeafPage* leaf_node, uint64_t key, const cha
     LEAF_KEY(leaf_node, insertion_point) = key;
     memcpy(LEAF_VALUE(leaf_node, insertion_point), value, SIZE_VALUE);
 	leaf_node->num_keys++;
-
-    // flush leaf node to the file page
-    flush_page_to_buffer(table_id, (Page*)leaf_node);
 }
 
 /* Inserts a new key and pointer
@@ -500,23 +864,31 @@ void insert_into_leaf(int table_id, LeafPage* leaf_node, uint64_t key, const cha
  * the tree's order, causing the leaf to be split
  * in half.
  */
-void insert_into_leaf_after_splitting(int table_id, LeafPage* leaf, uint64_t key, const char* value) {
+void insert_into_leaf_after_splitting(int table_id, TreePath* path, LeafPage* leaf, uint64_t key, const char* value) {
 
-	int insertion_index, split, i, j;
+	int insertion_index, split, append, i, j;
     uint64_t new_key;
 
     // make a new leaf node
     LeafPage new_leaf;
     new_leaf.is_leaf = true;
     new_leaf.num_keys = 0;
+    new_leaf.format = LEAF_SOA_MAGIC;
 
-    insertion_index = 0;
-    while (insertion_index < order_leaf - 1 && LEAF_KEY(leaf, insertion_index) < key)
-		insertion_index++;
+    insertion_index = search_lower(LEAF_KEYS(leaf), LEAF_KEY_STRIDE, order_leaf - 1, key);
 
 	split = cut(order_leaf - 1);
-
-    if (insertion_index < split) {
+    append = leaf->sibling == 0 && insertion_index == order_leaf - 1;
+
+    if (append) {
+        /* Case: append past the largest key of the tree.
+         * Keys keep coming in order : the old leaf stays full
+         * and the new key starts an empty leaf.
+         */
+        LEAF_KEY(&new_leaf, 0) = key;
+        memcpy(LEAF_VALUE(&new_leaf, 0), value, SIZE_VALUE);
+        new_leaf.num_keys++;
+    } else if (insertion_index < split) {
         // new key is going to inserted to the old leaf
         for (i = split - 1, j = 0; i < order_leaf - 1; i++, j++) {
             LEAF_KEY(&new_leaf, j) = LEAF_KEY(leaf, i);
@@ -553,6 +925,7 @@ void insert_into_leaf_after_splitting(int table_id, LeafPage* leaf, uint64_t key
    
     // allocate a page for new leaf
     new_leaf.file_offset = get_free_page(table_id);
+    stats_add_pages(table_id, 1, 0, 0);
 
     /* Set default page lsn. */
     new_leaf.page_lsn = -1;
@@ -560,6 +933,13 @@ void insert_into_leaf_after_splitting(int table_id, LeafPage* leaf, uint64_t key
     // linked-list of leaves
 	new_leaf.sibling = leaf->sibling;
 	leaf->sibling = new_leaf.file_offset;
+    if (new_leaf.sibling == 0) {
+        rightmost_leaf[table_id - 1] = new_leaf.file_offset;
+    }
+    // Parents of the leaf split unevenly only for an append.
+    if (!append) {
+        path->rightmost = 0;
+    }
    
     // clear garbage records
 	for (i = leaf->num_keys; i < order_leaf - 1; i++) {
@@ -571,7 +951,7 @@ void insert_into_leaf_after_splitting(int table_id, LeafPage* leaf, uint64_t key
         memset(LEAF_VALUE(&new_leaf, i), 0, SIZE_VALUE);
     }
 
-	new_leaf.parent = leaf->parent;
+	new_leaf.parent = 0;
 
     flush_page_to_buffer(table_id, (Page*)leaf);
     flush_page_to_buffer(table_id, (Page*)&new_leaf);
@@ -579,7 +959,7 @@ void insert_into_leaf_after_splitting(int table_id, LeafPage* leaf, uint64_t key
 	new_key = LEAF_KEY(&new_leaf, 0);
 
     // insert new key and new leaf to the parent
-	insert_into_parent(table_id, (NodePage*)leaf, new_key, (NodePage*)&new_leaf);
+	insert_into_parent(table_id, path, path->height - 1, (NodePage*)leaf, new_key, (NodePage*)&new_leaf);
 }
 
 /* Inserts a new key and pointer to a node
@@ -602,8 +982,9 @@ void insert_into_node(InternalPage* n, int left_index, uint64_t key, off_t right
  * into a node, causing the node's size to exceed
  * the order, and causing the node to split into two.
  */
-void insert_into_node_after_splitting(int table_id, InternalPage* old_node, int left_index, uint64_t key, off_t right_offset) {
-    int i, j, split, k_prime;
+void insert_into_node_after_splitting(int table_id, TreePath* path, int level, InternalPage* old_node, int left_index, uint64_t key, off_t right_offset) {
+    int i, j, split;
+	uint64_t k_prime;
 	uint64_t* temp_keys;
 	off_t* temp_pointers;
 
@@ -646,10 +1027,19 @@ void insert_into_node_after_splitting(int table_id, InternalPage* old_node, int
 	 */  
 	split = cut(order_internal);
 
+    /* Case: append on the right edge of the tree.
+     * The old node stays full, the new node starts
+     * with its last two children.
+     */
+    if (path->rightmost && left_index == old_node->num_keys) {
+        split = order_internal - 1;
+    }
+
     InternalPage new_node;
 	new_node.num_keys = 0;
     new_node.is_leaf = 0;
     new_node.file_offset = get_free_page(table_id);
+    stats_add_pages(table_id, 0, 1, 0);
 
     /* Set default page lsn */
     new_node.page_lsn = -1;
@@ -670,13 +1060,8 @@ void insert_into_node_after_splitting(int table_id, InternalPage* old_node, int
 	INTERNAL_OFFSET(&new_node, j) = temp_pointers[i];
 	free(temp_pointers);
 	free(temp_keys);
-	new_node.parent = old_node->parent;
-	for (i = 0; i <= new_node.num_keys; i++) {
-		NodePage child_page;
-        load_page_from_buffer(table_id, INTERNAL_OFFSET(&new_node, i), (Page*)&child_page);
-        child_page.parent = new_node.file_offset;
-        flush_page_to_buffer(table_id, (Page*)&child_page);
-    }
+	// Children moved to the new node are not touched : nodes have no parent pointer.
+	new_node.parent = 0;
 
     // clear garbage record
     for (i = old_node->num_keys; i < order_internal - 1; i++) {
@@ -697,33 +1082,33 @@ void insert_into_node_after_splitting(int table_id, InternalPage* old_node, int
 	 * nodes resulting from the split, with
 	 * the old node to the left and the new to the right.
 	 */
-	insert_into_parent(table_id, (NodePage*)old_node, k_prime, (NodePage*)&new_node);
+	insert_into_parent(table_id, path, level, (NodePage*)old_node, k_prime, (NodePage*)&new_node);
 }
 
 /* Inserts a new node (leaf or internal node) into the B+ tree.
- * Returns the root of the tree after insertion.
+ * left is the page at path->offsets[level] : its parent
+ * is the page above it in the path.
  */
-void insert_into_parent(int table_id, NodePage* left, uint64_t key, NodePage* right) {
-	//off_t left_index;
+void insert_into_parent(int table_id, TreePath* path, int level, NodePage* left, uint64_t key, NodePage* right) {
     InternalPage parent_node;
 
     /* Case: new root. */
-	if (left->parent == 0) {
+	if (level == 0) {
 		insert_into_new_root(table_id, left, key, right);
         return;
     }
 
-    load_page_from_buffer(table_id, left->parent, (Page*)&parent_node);
+    load_page_from_buffer(table_id, path->offsets[level - 1], (Page*)&parent_node);
 
 	/* Case: leaf or node. (Remainder of
 	 * function body.)  
 	 */
 
-	/* Find the parent's pointer to the left 
-	 * node.
+	/* The parent's pointer to the left 
+	 * node was followed by the descent.
 	 */
 
-	int left_index = get_left_index(&parent_node, left->file_offset);
+	int left_index = path->indexes[level - 1];
 
 	/* Simple case: the new key fits into the node. 
 	 */
@@ -738,7 +1123,7 @@ void insert_into_parent(int table_id, NodePage* left, uint64_t key, NodePage* ri
 	 * to preserve the B+ tree properties.
 	 */
 
-	return insert_into_node_after_splitting(table_id, &parent_node, left_index, key, right->file_offset);
+	return insert_into_node_after_splitting(table_id, path, level - 1, &parent_node, left_index, key, right->file_offset);
 }
 
 /* Creates a new root for two subtrees
@@ -750,6 +1135,7 @@ void insert_into_new_root(int table_id, NodePage* left, uint64_t key, NodePage*
     InternalPage root_node;
     memset(&root_node, 0, sizeof(InternalPage));
     root_node.file_offset = get_free_page(table_id);
+    stats_add_pages(table_id, 0, 1, 1);
 
     /* Set default page lsn */
     root_node.page_lsn = -1;
@@ -760,12 +1146,8 @@ void insert_into_new_root(int table_id, NodePage* left, uint64_t key, NodePage*
     root_node.num_keys++;
     root_node.parent = 0;
     root_node.is_leaf = 0;
-    left->parent = root_node.file_offset;
-    right->parent = root_node.file_offset;
 
     flush_page_to_buffer(table_id, (Page*)&root_node);
-    flush_page_to_buffer(table_id, (Page*)left);
-    flush_page_to_buffer(table_id, (Page*)right);
 
     dbheader[table_id - 1].root_offset = root_node.file_offset;
     flush_page_to_buffer(table_id, (Page*)(dbheader + table_id - 1));
@@ -778,10 +1160,13 @@ void start_new_tree(int table_id, uint64_t key, const char* value) {
     
     off_t root_offset = get_free_page(table_id);
     root_node.file_offset = root_offset;
+    stats_add_pages(table_id, 1, 0, 1);
+    stats_add_keys(table_id, 1, key, key);
 
     root_node.parent = 0;
     root_node.is_leaf = 1;
     root_node.num_keys = 1;
+    root_node.format = LEAF_SOA_MAGIC;
     LEAF_KEY(&root_node, 0) = key;
     root_node.sibling = 0;
 
@@ -796,6 +1181,57 @@ void start_new_tree(int table_id, uint64_t key, const char* value) {
     flush_page_to_buffer(table_id, (Page*)(dbheader + table_id - 1));
 }
 
+/* Case: append to the rightmost leaf with room.
+ * Key is past the largest key : no duplicate and no descent.
+ * Returns 1 if the record was appended.
+ */
+static int insert_append(int table_id, uint64_t key, const char* value) {
+    LeafPage* leaf_node;
+
+    leaf_node = find_rightmost_pinned(table_id, key);
+    if (leaf_node == NULL) {
+        return 0;
+    }
+    if (leaf_node->num_keys == order_leaf - 1) {
+        buf_unpin((Page*)leaf_node, 0);
+        return 0;
+    }
+
+    LEAF_KEY(leaf_node, leaf_node->num_keys) = key;
+    memcpy(LEAF_VALUE(leaf_node, leaf_node->num_keys), value, SIZE_VALUE);
+    leaf_node->num_keys++;
+    buf_unpin((Page*)leaf_node, 1);
+    stats_add_keys(table_id, 1, key, key);
+    return 1;
+}
+
+/* Inserts a key that is not in the pinned leaf
+ * found by the descent, and unpins the leaf.
+ */
+static void insert_into_tree(int table_id, TreePath* path, LeafPage* leaf_node, uint64_t key, const char* value) {
+    stats_add_keys(table_id, 1, key, key);
+    if (leaf_node->sibling == 0) {
+        rightmost_leaf[table_id - 1] = leaf_node->file_offset;
+    }
+
+	/* Case: leaf has room for key and pointer.
+	 */
+
+	if (leaf_node->num_keys < order_leaf - 1) {
+        insert_into_leaf(leaf_node, key, value);
+        buf_unpin((Page*)leaf_node, 1);
+	} else {
+    	/* Case:  leaf must be split.
+         * Splitting touches other pages, so work on a copy.
+	     */
+        LeafPage leaf_copy;
+        memcpy(&leaf_copy, leaf_node, sizeof(LeafPage));
+        buf_unpin((Page*)leaf_node, 0);
+
+        insert_into_leaf_after_splitting(table_id, path, &leaf_copy, key, value);
+    }
+}
+
 /* Master insertion function.
  * Inserts a key and an associated value into
  * the B+ tree, causing the tree to be adjusted
@@ -806,138 +1242,690 @@ int insert(int table_id, uint64_t key, const char* value) {
     /* The current implementation ignores
 	 * duplicates.
 	 */
-    char* value_found = NULL;
+    LeafPage* leaf_node;
+    TreePath path;
 
-    if ((value_found = find(table_id, key)) != 0) {
-        free(value_found);
-        return -1;
+    engine_lock();
+
+    if (insert_append(table_id, key, value)) {
+        engine_unlock();
+        return 0;
     }
+
 	/* Case: the tree does not exist yet.
 	 * Start a new tree.
 	 */
 
 	if (dbheader[table_id - 1].root_offset == 0) {
 		start_new_tree(table_id, key, value);
+        engine_unlock();
         return 0;
     }
 	
     /* Case: the tree already exists.
-	 * (Rest of function body.)
-	 */
-
-    LeafPage leaf_node;
-    find_leaf(table_id, key, &leaf_node);
-
-	/* Case: leaf has room for key and pointer.
+	 * One descent finds the leaf and the duplicate.
 	 */
 
-	if (leaf_node.num_keys < order_leaf - 1) {
-        insert_into_leaf(table_id, &leaf_node, key, value);
-	} else {
-    	/* Case:  leaf must be split.
-	     */
-        insert_into_leaf_after_splitting(table_id, &leaf_node, key, value);
+    leaf_node = find_leaf_path(table_id, key, &path);
+    if (leaf_node == NULL) {
+        engine_unlock();
+        return -1;
+    }
+    if (LEAF_FIND(leaf_node, key) != -1) {
+        buf_unpin((Page*)leaf_node, 0);
+        engine_unlock();
+        return -1;
     }
+
+    insert_into_tree(table_id, &path, leaf_node, key, value);
+    engine_unlock();
     return 0;
 }
 
-// DELETION.
-
-/* Utility function for deletion.  Retrieves
- * the index of a node's nearest neighbor (sibling)
- * to the left if one exists.  If not (the node
- * is the leftmost child), returns -1 to signify
- * this special case.
+/* Batched insert */
+/* Spreads m merged records over leaves, in key order.
+ * The first leaf keeps the page of the old leaf, the others
+ * take new pages and are linked after it.
+ * An append fills the leaves, otherwise they are filled evenly.
+ * Returns the number of leaves.
  */
-int get_neighbor_index(int table_id, NodePage* node_page) {
+static int batch_fill_leaves(int table_id, LeafPage* old_leaf, uint64_t* keys, const char** values,
+        int m, int append, LeafPage* leaves) {
+    int i, j, k, count, num_leaves, per_leaf, extra;
+    int capacity = order_leaf - 1;
 
-	int i;
+    num_leaves = (m + capacity - 1) / capacity;
+    per_leaf = m / num_leaves;
+    extra = m % num_leaves;
 
-	/* Return the index of the key to the left
-	 * of the pointer in the parent pointing
-	 * to n.  
-	 * If n is the leftmost child, this means
-	 * return -1.
-	 */
-    InternalPage parent_node;
-    load_page_from_buffer(table_id, node_page->parent, (Page*)&parent_node);
-	for (i = 0; i <= parent_node.num_keys; i++)
-		if (INTERNAL_OFFSET(&parent_node, i) == node_page->file_offset)
-			return i - 1;
+    for (j = 0, k = 0; j < num_leaves; j++) {
+        LeafPage* leaf = leaves + j;
 
-	// Error state.
-    assert("Search for nonexistent pointer to node in parent.");
-    return -1;
+        if (append) {
+            count = m - k < capacity ? m - k : capacity;
+        } else {
+            count = per_leaf + (j < extra);
+        }
+
+        memset(leaf, 0, sizeof(LeafPage));
+        leaf->is_leaf = 1;
+        leaf->format = LEAF_SOA_MAGIC;
+        if (j == 0) {
+            leaf->file_offset = old_leaf->file_offset;
+            leaf->page_lsn = old_leaf->page_lsn;
+        } else {
+            leaf->file_offset = get_free_page(table_id);
+            stats_add_pages(table_id, 1, 0, 0);
+            leaf->page_lsn = -1;
+            leaves[j - 1].sibling = leaf->file_offset;
+        }
+
+        for (i = 0; i < count; i++, k++) {
+            LEAF_KEY(leaf, i) = keys[k];
+            memcpy(LEAF_VALUE(leaf, i), values[k], SIZE_VALUE);
+        }
+        leaf->num_keys = count;
+    }
+    leaves[num_leaves - 1].sibling = old_leaf->sibling;
+
+    return num_leaves;
 }
 
-void remove_entry_from_node(int table_id, NodePage* node_page, uint64_t key) {
+/* Inserts n records with one descent per target leaf.
+ * Records are sorted, and the ones that fall into the same leaf
+ * are merged with its records in one pass : in place if they fit,
+ * otherwise over as many leaves as needed, the new leaves being
+ * added to the parent one after the other.
+ */
+int insert_batch(int table_id, const uint64_t *keys, const char *values, int n) {
+    ManyKey* sorted = NULL;
+    LeafPage *leaves = NULL, *leaf_node, old_leaf;
+    InternalPage* parent_node;
+    uint64_t *new_keys = NULL, *merged_keys = NULL, key;
+    const char **new_values = NULL, **merged_values = NULL;
+    TreePath path;
+    int i, j, w, pos, end, count, m, limit, append, num_leaves, result = 0;
 
-	int i;
-    int key_idx = 0;
+    engine_lock();
 
-    if (node_page->is_leaf) {
-        LeafPage* leaf_node = (LeafPage*)node_page;
+    // Failure case
+    if (table_id < 1 || table_id > 10 || buf_size == -1 || buf_mgr == NULL || dbfile[table_id - 1] <= 0 ||
+            n < 0 || (n > 0 && (keys == NULL || values == NULL))) {
+        engine_unlock();
+        return -1;
+    }
 
-        // find a slot of deleting key
-        for (i = 0; i < leaf_node->num_keys; i++) {
-            if (LEAF_KEY(leaf_node, i) == key) {
-                key_idx = i;
-                break;
-            }
-        }
-        if (i == leaf_node->num_keys) {
-            assert("remove_entry_from_node: no key in this page");
-        }
+    // Case : nothing to insert.
+    if (n == 0) {
+        engine_unlock();
+        return 0;
+    }
 
-        // shift records
-        for (i = key_idx; i < leaf_node->num_keys - 1; i++) {
-            LEAF_KEY(leaf_node, i) = LEAF_KEY(leaf_node, i+1);
-            memcpy(LEAF_VALUE(leaf_node, i), LEAF_VALUE(leaf_node, i+1), SIZE_VALUE);
+    limit = INSERT_BATCH_LEAVES * (order_leaf - 1);
+    sorted = (ManyKey*)malloc(n * sizeof(ManyKey));
+    leaves = (LeafPage*)malloc(INSERT_BATCH_LEAVES * sizeof(LeafPage));
+    new_keys = (uint64_t*)malloc(limit * sizeof(uint64_t));
+    new_values = (const char**)malloc(limit * sizeof(char*));
+    merged_keys = (uint64_t*)malloc(limit * sizeof(uint64_t));
+    merged_values = (const char**)malloc(limit * sizeof(char*));
+    if (sorted == NULL || leaves == NULL || new_keys == NULL || new_values == NULL ||
+            merged_keys == NULL || merged_values == NULL) {
+        result = -1;
+        n = 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        sorted[i].key = keys[i];
+        sorted[i].index = i;
+    }
+    if (n > 0) {
+        qsort(sorted, n, sizeof(ManyKey), compare_many_key);
+    }
+
+    pos = 0;
+    while (pos < n) {
+        key = sorted[pos].key;
+
+        // Case : repeated key in the batch. The first one was inserted.
+        if (pos > 0 && sorted[pos - 1].key == key) {
+            pos++;
+            continue;
         }
-        // clear garbage record
-        LEAF_KEY(leaf_node, leaf_node->num_keys - 1) = 0;
-        memset(LEAF_VALUE(leaf_node, leaf_node->num_keys - 1), 0, SIZE_VALUE);
 
-        leaf_node->num_keys--;
+        /* Case: the tree does not exist yet.
+         * Start a new tree, the next records go into its leaf.
+         */
+        if (dbheader[table_id - 1].root_offset == 0) {
+            start_new_tree(table_id, key, values + (size_t)sorted[pos].index * SIZE_VALUE);
+            result++;
+            pos++;
+            continue;
+        }
 
-    } else {
-        InternalPage* internal_node = (InternalPage*)node_page;
+        leaf_node = find_leaf_path(table_id, key, &path);
+        if (leaf_node == NULL) {
+            result = -1;
+            break;
+        }
+        if (leaf_node->sibling == 0) {
+            rightmost_leaf[table_id - 1] = leaf_node->file_offset;
+        }
 
-        // find a slot of deleting key
-        for (i = 0; i < internal_node->num_keys; i++) {
-            if (INTERNAL_KEY(internal_node, i) == key) {
-                key_idx = i;
+        // Records of this leaf : below the fence, as many as the leaves can hold.
+        for (end = pos; end < n && end - pos < limit - leaf_node->num_keys; end++) {
+            if (!path.rightmost && sorted[end].key >= path.fence) {
                 break;
             }
         }
-        if (i == internal_node->num_keys) {
-            assert("remove_entry_from_node: no key in this page");
-        }
 
-        // shift keys/pointers
-        for (i = key_idx; i < internal_node->num_keys - 1; i++) {
-            INTERNAL_KEY(internal_node, i) = INTERNAL_KEY(internal_node, i+1);
-            INTERNAL_OFFSET(internal_node, i+1) = INTERNAL_OFFSET(internal_node, i+2);
+        // New records : not repeated, not in the leaf.
+        for (count = 0, i = 0, j = pos; j < end; j++) {
+            key = sorted[j].key;
+            if (j > pos && sorted[j - 1].key == key) {
+                continue;
+            }
+            while (i < leaf_node->num_keys && LEAF_KEY(leaf_node, i) < key) {
+                i++;
+            }
+            if (i < leaf_node->num_keys && LEAF_KEY(leaf_node, i) == key) {
+                continue;
+            }
+            new_keys[count] = key;
+            new_values[count++] = values + (size_t)sorted[j].index * SIZE_VALUE;
+        }
+        pos = end;
+        result += count;
+        if (count > 0) {
+            stats_add_keys(table_id, count, new_keys[0], new_keys[count - 1]);
         }
-        // clear garbage key/pointer
-        INTERNAL_KEY(internal_node, internal_node->num_keys - 1) = 0;
-        INTERNAL_OFFSET(internal_node, internal_node->num_keys) = 0;
 
-        internal_node->num_keys--;
-    }
+        // Case : every key is in the table already.
+        if (count == 0) {
+            buf_unpin((Page*)leaf_node, 0);
+            continue;
+        }
 
-    flush_page_to_buffer(table_id, (Page*)node_page);
-}
+        /* Case: leaf has room for the new records.
+         * Merge from the last record, in the frame.
+         */
+        if (leaf_node->num_keys + count <= order_leaf - 1) {
+            i = leaf_node->num_keys - 1;
+            j = count - 1;
+            for (w = leaf_node->num_keys + count - 1; j >= 0; w--) {
+                if (i >= 0 && LEAF_KEY(leaf_node, i) > new_keys[j]) {
+                    LEAF_KEY(leaf_node, w) = LEAF_KEY(leaf_node, i);
+                    memcpy(LEAF_VALUE(leaf_node, w), LEAF_VALUE(leaf_node, i), SIZE_VALUE);
+                    i--;
+                } else {
+                    LEAF_KEY(leaf_node, w) = new_keys[j];
+                    memcpy(LEAF_VALUE(leaf_node, w), new_values[j], SIZE_VALUE);
+                    j--;
+                }
+            }
+            leaf_node->num_keys += count;
+            buf_unpin((Page*)leaf_node, 1);
+            continue;
+        }
 
-void adjust_root(int table_id) {
+        /* Case: leaf must be split.
+         * Splitting touches other pages, so work on a copy.
+         */
+        memcpy(&old_leaf, leaf_node, sizeof(LeafPage));
+        buf_unpin((Page*)leaf_node, 0);
+
+        for (m = 0, i = 0, j = 0; i < old_leaf.num_keys || j < count; m++) {
+            if (j == count || (i < old_leaf.num_keys && LEAF_KEY(&old_leaf, i) < new_keys[j])) {
+                merged_keys[m] = LEAF_KEY(&old_leaf, i);
+                merged_values[m] = LEAF_VALUE(&old_leaf, i);
+                i++;
+            } else {
+                merged_keys[m] = new_keys[j];
+                merged_values[m] = new_values[j];
+                j++;
+            }
+        }
 
-    NodePage root_page;
-    load_page_from_buffer(table_id, dbheader[table_id - 1].root_offset, (Page*)&root_page);
+        // Past the largest key of the tree : the old records did not move.
+        append = old_leaf.sibling == 0 &&
+            (old_leaf.num_keys == 0 || new_keys[0] > LEAF_KEY(&old_leaf, old_leaf.num_keys - 1));
 
-	/* Case: nonempty root.
-	 * Key and pointer have already been deleted,
-	 * so nothing to be done.
-	 */
+        num_leaves = batch_fill_leaves(table_id, &old_leaf, merged_keys, merged_values, m, append, leaves);
+        for (j = 0; j < num_leaves; j++) {
+            flush_page_to_buffer(table_id, (Page*)(leaves + j));
+        }
+        if (leaves[num_leaves - 1].sibling == 0) {
+            rightmost_leaf[table_id - 1] = leaves[num_leaves - 1].file_offset;
+        }
+
+        // Case : the parent has room for every new leaf. Add them in the frame.
+        if (path.height > 1) {
+            parent_node = (InternalPage*)buf_pin(table_id, path.offsets[path.height - 2]);
+            if (parent_node == NULL) {
+                result = -1;
+                break;
+            }
+            if (parent_node->num_keys + num_leaves - 1 <= order_internal - 1) {
+                for (j = 1; j < num_leaves; j++) {
+                    insert_into_node(parent_node, path.indexes[path.height - 2] + j - 1,
+                            LEAF_KEY(leaves + j, 0), leaves[j].file_offset);
+                }
+                buf_unpin((Page*)parent_node, 1);
+                continue;
+            }
+            buf_unpin((Page*)parent_node, 0);
+        }
+
+        // Add the new leaves to the parent one by one : it is split on the way.
+        for (j = 1; j < num_leaves; j++) {
+            // The parent may have been split : find the path of the left leaf again.
+            if (j > 1) {
+                leaf_node = find_leaf_path(table_id, LEAF_KEY(leaves + j - 1, 0), &path);
+                if (leaf_node == NULL) {
+                    result = -1;
+                    break;
+                }
+                buf_unpin((Page*)leaf_node, 0);
+            }
+            // Parents of the leaf split unevenly only for an append.
+            if (!append) {
+                path.rightmost = 0;
+            }
+            insert_into_parent(table_id, &path, path.height - 1,
+                    (NodePage*)(leaves + j - 1), LEAF_KEY(leaves + j, 0), (NodePage*)(leaves + j));
+        }
+        if (result == -1) {
+            break;
+        }
+    }
+
+    engine_unlock();
+
+    free(sorted);
+    free(leaves);
+    free(new_keys);
+    free(new_values);
+    free(merged_keys);
+    free(merged_values);
+    return result;
+}
+
+/* Bulk load */
+// Take the next page at the end of the file.
+static off_t bulk_alloc_page(int table_id){
+    off_t offset = dbheader[table_id - 1].num_pages * PAGE_SIZE;
+
+    dbheader[table_id - 1].num_pages++;
+    return offset;
+}
+
+static void bulk_flush_batch(BulkLoad *bulk){
+    writeback_pages(bulk->ios, bulk->num_batch);
+    bulk->num_batch = 0;
+}
+
+// Copy a finished page to the write batch.
+static void bulk_write(BulkLoad *bulk, NodePage *node){
+    Page *page = bulk->batch + bulk->num_batch;
+
+    memcpy(page, node, sizeof(Page));
+    bulk->ios[bulk->num_batch].table_id = bulk->table_id;
+    bulk->ios[bulk->num_batch].page = page;
+    bulk->num_batch++;
+
+    if(bulk->num_batch == BULK_LOAD_BATCH){
+        bulk_flush_batch(bulk);
+    }
+}
+
+// Start a new node of the level, in the page prev doesn't use.
+static void bulk_start_node(BulkLoad *bulk, int level){
+    BulkLevel *lv = &bulk->levels[level];
+    NodePage *node;
+
+    node = (NodePage*)(lv->prev == (NodePage*)&lv->pages[0] ? &lv->pages[1] : &lv->pages[0]);
+    memset(node, 0, sizeof(Page));
+    node->file_offset = bulk_alloc_page(bulk->table_id);
+    node->is_leaf = level == 0;
+    bulk->num_nodes[level > 0]++;
+    node->page_lsn = -1;
+    if(level == 0){
+        ((LeafPage*)node)->format = LEAF_SOA_MAGIC;
+    }
+
+    lv->node = node;
+    lv->children = 0;
+}
+
+// Node of the level is full : add prev to the parent level,
+// keep the node as prev and start a new node.
+static int bulk_next_node(BulkLoad *bulk, int level){
+    BulkLevel *lv = &bulk->levels[level];
+
+    if(lv->prev != NULL && bulk_push(bulk, level + 1, lv->prev) != 0){
+        return -1;
+    }
+    lv->prev = lv->node;
+    lv->prev_children = lv->children;
+    bulk_start_node(bulk, level);
+
+    // linked-list of leaves
+    if(level == 0){
+        ((LeafPage*)lv->prev)->sibling = lv->node->file_offset;
+    }
+    return 0;
+}
+
+// Add a finished node of level - 1 as the last child of the node of level, then write it.
+static int bulk_push(BulkLoad *bulk, int level, NodePage *child){
+    BulkLevel *lv = &bulk->levels[level];
+    InternalPage *node;
+    uint64_t first_key;
+
+    // Case : first node of a new level.
+    if(level == bulk->height){
+        if(level == TREE_MAX_HEIGHT){
+            return -1;
+        }
+        bulk->height++;
+        bulk_start_node(bulk, level);
+    }
+    else if(lv->children == bulk->internal_capacity && bulk_next_node(bulk, level) != 0){
+        return -1;
+    }
+
+    // Smallest key under the child
+    if(child->is_leaf){
+        first_key = LEAF_KEY((LeafPage*)child, 0);
+    }
+    else{
+        first_key = ((InternalPage*)child)->irecords[0].key;
+        ((InternalPage*)child)->irecords[0].key = 0;
+    }
+
+    node = (InternalPage*)lv->node;
+    if(lv->children == 0){
+        node->irecords[0].key = first_key;
+    }
+    else{
+        INTERNAL_KEY(node, node->num_keys) = first_key;
+        node->num_keys++;
+    }
+    INTERNAL_OFFSET(node, lv->children) = child->file_offset;
+    lv->children++;
+
+    bulk_write(bulk, child);
+    return 0;
+}
+
+// Last node of the level has less than half of prev : move the tail of prev to it.
+static void bulk_balance(BulkLoad *bulk, int level){
+    BulkLevel *lv = &bulk->levels[level];
+    int move, from;
+
+    if(lv->children * 2 >= lv->prev_children){
+        return;
+    }
+    move = (lv->prev_children - lv->children) / 2;
+    from = lv->prev_children - move;
+
+    if(level == 0){
+        LeafPage *prev = (LeafPage*)lv->prev, *node = (LeafPage*)lv->node;
+
+        memmove(node->keys + move, node->keys, lv->children * sizeof(uint64_t));
+        memmove(node->values[move], node->values[0], lv->children * SIZE_VALUE);
+        memcpy(node->keys, prev->keys + from, move * sizeof(uint64_t));
+        memcpy(node->values[0], prev->values[from], move * SIZE_VALUE);
+
+        // clear garbage records
+        memset(prev->keys + from, 0, move * sizeof(uint64_t));
+        memset(prev->values[from], 0, move * SIZE_VALUE);
+        prev->num_keys -= move;
+        node->num_keys += move;
+    }
+    else{
+        InternalPage *prev = (InternalPage*)lv->prev, *node = (InternalPage*)lv->node;
+
+        // irecords[0].key is the first key under child 0 : records move with their keys.
+        memmove(node->irecords + move, node->irecords, lv->children * sizeof(InternalRecord));
+        memcpy(node->irecords, prev->irecords + from, move * sizeof(InternalRecord));
+        memset(prev->irecords + from, 0, move * sizeof(InternalRecord));
+        prev->num_keys -= move;
+        node->num_keys += move;
+    }
+
+    lv->prev_children -= move;
+    lv->children += move;
+}
+
+// Input ended : add the last nodes of each level to their parents, bottom-up.
+// Returns the root offset, 0 on failure.
+static off_t bulk_finish(BulkLoad *bulk){
+    BulkLevel *lv;
+    off_t root = 0;
+    int level;
+
+    for(level = 0; level < bulk->height; level++){
+        lv = &bulk->levels[level];
+
+        // Case : top level. Its only node is the root.
+        if(level == bulk->height - 1 && lv->prev == NULL){
+            if(!lv->node->is_leaf){
+                ((InternalPage*)lv->node)->irecords[0].key = 0;
+            }
+            bulk_write(bulk, lv->node);
+            root = lv->node->file_offset;
+            break;
+        }
+
+        bulk_balance(bulk, level);
+        if(bulk_push(bulk, level + 1, lv->prev) != 0 || bulk_push(bulk, level + 1, lv->node) != 0){
+            return 0;
+        }
+    }
+
+    bulk_flush_batch(bulk);
+    return root;
+}
+
+/* Build the tree of an empty table from sorted records.
+ * Leaves are filled left to right and linked as they go,
+ * each full node is added to its parent on the level above.
+ * Pages come from the end of the file in order : the leaves are
+ * written in long runs and no page is split or read back.
+ */
+int bulk_load(int table_id, BulkLoadIterator next, void *arg, int fill_factor){
+    BulkLoad *bulk;
+    BulkLevel *leaves;
+    LeafPage *leaf;
+    uint64_t key, first_key = 0, last_key = 0, num_pages;
+    char value[SIZE_VALUE];
+    int ret, count = 0;
+    off_t root;
+
+    engine_lock();
+
+    // Failure case
+    if(table_id < 1 || table_id > 10 || buf_size == -1 || buf_mgr == NULL || dbfile[table_id - 1] <= 0 ||
+            next == NULL || fill_factor < 1 || fill_factor > 100){
+        engine_unlock();
+        return -1;
+    }
+
+    // Case : table is not empty.
+    if(dbheader[table_id - 1].root_offset != 0){
+        engine_unlock();
+        return -1;
+    }
+
+    bulk = (BulkLoad*)calloc(1, sizeof(BulkLoad));
+    if(bulk != NULL){
+        bulk->batch = (Page*)malloc(BULK_LOAD_BATCH * sizeof(Page));
+        bulk->ios = (PageIO*)malloc(BULK_LOAD_BATCH * sizeof(PageIO));
+    }
+    if(bulk == NULL || bulk->batch == NULL || bulk->ios == NULL){
+        if(bulk != NULL){
+            free(bulk->batch);
+            free(bulk->ios);
+            free(bulk);
+        }
+        engine_unlock();
+        return -1;
+    }
+
+    bulk->table_id = table_id;
+    bulk->leaf_capacity = (order_leaf - 1) * fill_factor / 100;
+    if(bulk->leaf_capacity < 1){
+        bulk->leaf_capacity = 1;
+    }
+    // Internal nodes need two children
+    bulk->internal_capacity = order_internal * fill_factor / 100;
+    if(bulk->internal_capacity < 3){
+        bulk->internal_capacity = 3;
+    }
+
+    num_pages = dbheader[table_id - 1].num_pages;
+    leaves = &bulk->levels[0];
+
+    while((ret = next(arg, &key, value)) == 1){
+        // Failure case : keys out of order or duplicated
+        if(count > 0 && key <= last_key){
+            ret = -1;
+            break;
+        }
+
+        if(leaves->node == NULL){
+            bulk->height = 1;
+            bulk_start_node(bulk, 0);
+        }
+        else if(leaves->children == bulk->leaf_capacity && bulk_next_node(bulk, 0) != 0){
+            ret = -1;
+            break;
+        }
+
+        leaf = (LeafPage*)leaves->node;
+        LEAF_KEY(leaf, leaf->num_keys) = key;
+        memcpy(LEAF_VALUE(leaf, leaf->num_keys), value, SIZE_VALUE);
+        leaf->num_keys++;
+        leaves->children++;
+
+        if(count == 0){
+            first_key = key;
+        }
+        last_key = key;
+        count++;
+    }
+
+    if(ret == 0 && count > 0){
+        root = bulk_finish(bulk);
+        if(root == 0){
+            ret = -1;
+        }
+        else{
+            // Tree is on disk : the header makes it visible.
+            dbheader[table_id - 1].root_offset = root;
+            dbheader[table_id - 1].stats.num_keys = count;
+            dbheader[table_id - 1].stats.min_key = first_key;
+            dbheader[table_id - 1].stats.max_key = last_key;
+            dbheader[table_id - 1].stats.height = bulk->height;
+            dbheader[table_id - 1].stats.num_leaves = bulk->num_nodes[0];
+            dbheader[table_id - 1].stats.num_internals = bulk->num_nodes[1];
+            dbheader[table_id - 1].stats_magic = TABLE_STATS_MAGIC;
+            flush_page_to_buffer(table_id, (Page*)(dbheader + table_id - 1));
+        }
+    }
+
+    // Failure : pages taken so far are past the end of the file again.
+    if(ret != 0){
+        dbheader[table_id - 1].num_pages = num_pages;
+    }
+
+    free(bulk->batch);
+    free(bulk->ios);
+    free(bulk);
+
+    engine_unlock();
+    return ret == 0 ? 0 : -1;
+}
+
+// DELETION.
+
+/* Utility function for deletion.  Retrieves
+ * the index of a node's nearest neighbor (sibling)
+ * to the left if one exists.  If not (the node
+ * is the leftmost child), returns -1 to signify
+ * this special case.
+ */
+int get_neighbor_index(TreePath* path, int level) {
+
+	/* Return the index of the key to the left
+	 * of the pointer in the parent pointing
+	 * to n : the descent followed that pointer.
+	 * If n is the leftmost child, this means
+	 * return -1.
+	 */
+	return path->indexes[level - 1] - 1;
+}
+
+void remove_entry_from_node(int table_id, NodePage* node_page, uint64_t key) {
+
+	int i;
+    int key_idx = 0;
+
+    if (node_page->is_leaf) {
+        LeafPage* leaf_node = (LeafPage*)node_page;
+
+        // find a slot of deleting key
+        key_idx = LEAF_FIND(leaf_node, key);
+        if (key_idx == -1) {
+            assert("remove_entry_from_node: no key in this page");
+            return;
+        }
+
+        // shift records
+        for (i = key_idx; i < leaf_node->num_keys - 1; i++) {
+            LEAF_KEY(leaf_node, i) = LEAF_KEY(leaf_node, i+1);
+            memcpy(LEAF_VALUE(leaf_node, i), LEAF_VALUE(leaf_node, i+1), SIZE_VALUE);
+        }
+        // clear garbage record
+        LEAF_KEY(leaf_node, leaf_node->num_keys - 1) = 0;
+        memset(LEAF_VALUE(leaf_node, leaf_node->num_keys - 1), 0, SIZE_VALUE);
+
+        leaf_node->num_keys--;
+
+    } else {
+        InternalPage* internal_node = (InternalPage*)node_page;
+
+        // find a slot of deleting key
+        key_idx = INTERNAL_FIND(internal_node, key);
+        if (key_idx == -1) {
+            assert("remove_entry_from_node: no key in this page");
+            return;
+        }
+
+        // shift keys/pointers
+        for (i = key_idx; i < internal_node->num_keys - 1; i++) {
+            INTERNAL_KEY(internal_node, i) = INTERNAL_KEY(internal_node, i+1);
+            INTERNAL_OFFSET(internal_node, i+1) = INTERNAL_OFFSET(internal_node, i+2);
+        }
+        // clear garbage key/pointer
+        INTERNAL_KEY(internal_node, internal_node->num_keys - 1) = 0;
+        INTERNAL_OFFSET(internal_node, internal_node->num_keys) = 0;
+
+        internal_node->num_keys--;
+    }
+
+    flush_page_to_buffer(table_id, (Page*)node_page);
+}
+
+void adjust_root(int table_id) {
+
+    NodePage root_page;
+    load_page_from_buffer(table_id, dbheader[table_id - 1].root_offset, (Page*)&root_page);
+
+	/* Case: nonempty root.
+	 * Key and pointer have already been deleted,
+	 * so nothing to be done.
+	 */
 
 	if (root_page.num_keys > 0)
         return;
@@ -952,12 +1940,7 @@ void adjust_root(int table_id) {
 	if (!root_page.is_leaf) {
         InternalPage* root_node = (InternalPage*)&root_page;
         dbheader[table_id - 1].root_offset = INTERNAL_OFFSET(root_node, 0);
-		
-        NodePage node_page;
-        load_page_from_buffer(table_id, dbheader[table_id - 1].root_offset, (Page*)&node_page);
-        node_page.parent = 0;
-
-        flush_page_to_buffer(table_id, (Page*)&node_page);
+        stats_add_pages(table_id, 0, -1, -1);
         flush_page_to_buffer(table_id, (Page*)(dbheader + table_id - 1));
 	}
 
@@ -966,6 +1949,7 @@ void adjust_root(int table_id) {
 
 	else {
         dbheader[table_id - 1].root_offset = 0;
+        stats_add_pages(table_id, -1, 0, -1);
         flush_page_to_buffer(table_id, (Page*)(dbheader + table_id - 1));
     }
 
@@ -978,7 +1962,7 @@ void adjust_root(int table_id) {
  * can accept the additional entries
  * without exceeding the maximum.
  */
-void coalesce_nodes(int table_id, NodePage* node_page, NodePage* neighbor_page, int neighbor_index, int k_prime) {
+void coalesce_nodes(int table_id, TreePath* path, int level, NodePage* node_page, NodePage* neighbor_page, int neighbor_index, uint64_t k_prime) {
 
 	int i, j, neighbor_insertion_index, n_end;
 	NodePage* tmp;
@@ -1031,19 +2015,10 @@ void coalesce_nodes(int table_id, NodePage* node_page, NodePage* neighbor_page,
 
 		INTERNAL_OFFSET(neighbor_node, i) = INTERNAL_OFFSET(node, j);
 
-		/* All children must now point up to the same parent.
-		 */
-
-		for (i = 0; i < neighbor_node->num_keys + 1; i++) {
-            NodePage child_page;
-            load_page_from_buffer(table_id, INTERNAL_OFFSET(neighbor_node, i), (Page*)&child_page);
-            child_page.parent = neighbor_node->file_offset;
-            flush_page_to_buffer(table_id, (Page*)&child_page);
-        }
-
         flush_page_to_buffer(table_id, (Page*)neighbor_node);
 
         put_free_page(table_id, node->file_offset);
+        stats_add_pages(table_id, 0, -1, 0);
 	}
 
 	/* In a leaf, append the keys and pointers of
@@ -1066,11 +2041,12 @@ void coalesce_nodes(int table_id, NodePage* node_page, NodePage* neighbor_page,
         flush_page_to_buffer(table_id, (Page*)neighbor_node);
 
         put_free_page(table_id, node->file_offset);
+        stats_add_pages(table_id, -1, 0, 0);
 	}
 
     NodePage parent_node;
-    load_page_from_buffer(table_id, node_page->parent, (Page*)&parent_node);
-	delete_entry(table_id, &parent_node, k_prime);
+    load_page_from_buffer(table_id, path->offsets[level - 1], (Page*)&parent_node);
+	delete_entry(table_id, path, level - 1, &parent_node, k_prime);
 }
 
 /* Redistributes entries between two nodes when
@@ -1079,9 +2055,9 @@ void coalesce_nodes(int table_id, NodePage* node_page, NodePage* neighbor_page,
  * small node's entries without exceeding the
  * maximum
  */
-void redistribute_nodes(int table_id, NodePage* node_page, NodePage* neighbor_page,
+void redistribute_nodes(int table_id, off_t parent_offset, NodePage* node_page, NodePage* neighbor_page,
                         int neighbor_index, 
-		                int k_prime_index, int k_prime) {  
+		                int k_prime_index, uint64_t k_prime) {  
 
 	int i;
 
@@ -1101,16 +2077,12 @@ void redistribute_nodes(int table_id, NodePage* node_page, NodePage* neighbor_pa
 		    	INTERNAL_OFFSET(node, i) = INTERNAL_OFFSET(node, i - 1);
 		    }
             INTERNAL_OFFSET(node, 0) = INTERNAL_OFFSET(neighbor_node, neighbor_node->num_keys);
-            NodePage child_page;
-            load_page_from_buffer(table_id, INTERNAL_OFFSET(node, 0), (Page*)&child_page);
-            child_page.parent = node->file_offset;
-            flush_page_to_buffer(table_id, (Page*)&child_page);
 
 			INTERNAL_OFFSET(neighbor_node, neighbor_node->num_keys) = 0;
 			INTERNAL_KEY(node, 0) = k_prime;
 
             InternalPage parent_node;
-            load_page_from_buffer(table_id, node->parent, (Page*)&parent_node);
+            load_page_from_buffer(table_id, parent_offset, (Page*)&parent_node);
             INTERNAL_KEY(&parent_node, k_prime_index) = INTERNAL_KEY(neighbor_node, neighbor_node->num_keys - 1);
             flush_page_to_buffer(table_id, (Page*)&parent_node);
 
@@ -1136,7 +2108,7 @@ void redistribute_nodes(int table_id, NodePage* node_page, NodePage* neighbor_pa
 			LEAF_KEY(node, 0) = LEAF_KEY(neighbor_node, neighbor_node->num_keys - 1);
 
             InternalPage parent_node;
-            load_page_from_buffer(table_id, node->parent, (Page*)&parent_node);
+            load_page_from_buffer(table_id, parent_offset, (Page*)&parent_node);
 			INTERNAL_KEY(&parent_node, k_prime_index) = LEAF_KEY(node, 0);
             flush_page_to_buffer(table_id, (Page*)&parent_node);
 
@@ -1166,7 +2138,7 @@ void redistribute_nodes(int table_id, NodePage* node_page, NodePage* neighbor_pa
 			memcpy(LEAF_VALUE(node, node->num_keys), LEAF_VALUE(neighbor_node, 0), SIZE_VALUE);
 
             InternalPage parent_node;
-            load_page_from_buffer(table_id, node->parent, (Page*)&parent_node);
+            load_page_from_buffer(table_id, parent_offset, (Page*)&parent_node);
 			INTERNAL_KEY(&parent_node, k_prime_index) = LEAF_KEY(neighbor_node, 1);
             flush_page_to_buffer(table_id, (Page*)&parent_node);
             
@@ -1191,14 +2163,9 @@ void redistribute_nodes(int table_id, NodePage* node_page, NodePage* neighbor_pa
 
 			INTERNAL_KEY(node, node->num_keys) = k_prime;
 			INTERNAL_OFFSET(node, node->num_keys + 1) = INTERNAL_OFFSET(neighbor_node, 0);
-            
-            NodePage child_page;
-            load_page_from_buffer(table_id, INTERNAL_OFFSET(node, node->num_keys + 1), (Page*)&child_page);
-            child_page.parent = node->file_offset;
-            flush_page_to_buffer(table_id, (Page*)&child_page);
 
             InternalPage parent_node;
-            load_page_from_buffer(table_id, node->parent, (Page*)&parent_node);
+            load_page_from_buffer(table_id, parent_offset, (Page*)&parent_node);
             INTERNAL_KEY(&parent_node, k_prime_index) = INTERNAL_KEY(neighbor_node, 0);
             flush_page_to_buffer(table_id, (Page*)&parent_node);
 
@@ -1225,52 +2192,18 @@ void redistribute_nodes(int table_id, NodePage* node_page, NodePage* neighbor_pa
 }
 
 
-/* Deletes an entry from the B+ tree.
- * Removes the record and its key and pointer
- * from the leaf, and then makes all appropriate
- * changes to preserve the B+ tree properties.
+/* Coalesces or redistributes a node
+ * below the root which has fallen
+ * below the minimum.
  */
-void delete_entry(int table_id, NodePage* node_page, uint64_t key) {
+void rebalance_node(int table_id, TreePath* path, int level, NodePage* node_page) {
 
-	int min_keys;
 	off_t neighbor_offset;
 	int neighbor_index;
-	int k_prime_index, k_prime;
+	int k_prime_index;
+	uint64_t k_prime;
 	int capacity;
 
-	// Remove key and pointer from node.
-
-	remove_entry_from_node(table_id, node_page, key);
-	/* Case:  deletion from the root. 
-	 */
-
-	if (dbheader[table_id - 1].root_offset == node_page->file_offset) {
-		adjust_root(table_id);
-        return;
-    }
-
-	/* Case:  deletion from a node below the root.
-	 * (Rest of function body.)
-	 */
-
-	/* Determine minimum allowable size of node,
-	 * to be preserved after deletion.
-	 */
-
-	min_keys = node_page->is_leaf ? cut(order_leaf - 1) : cut(order_internal) - 1;
-
-	/* Case:  node stays at or above minimum.
-	 * (The simple case.)
-	 */
-
-	if (node_page->num_keys >= min_keys)
-        return;
-	
-    /* Case:  node falls below minimum.
-	 * Either coalescence or redistribution
-	 * is needed.
-	 */
-
 	/* Find the appropriate neighbor node with which
 	 * to coalesce.
 	 * Also find the key (k_prime) in the parent
@@ -1278,11 +2211,11 @@ void delete_entry(int table_id, NodePage* node_page, uint64_t key) {
 	 * to the neighbor.
 	 */
 
-	neighbor_index = get_neighbor_index(table_id, node_page);
+	neighbor_index = get_neighbor_index(path, level);
 	k_prime_index = neighbor_index == -1 ? 0 : neighbor_index;
 
     InternalPage parent_node;
-    load_page_from_buffer(table_id, node_page->parent, (Page*)&parent_node);
+    load_page_from_buffer(table_id, path->offsets[level - 1], (Page*)&parent_node);
 
 	k_prime = INTERNAL_KEY(&parent_node, k_prime_index);
 	neighbor_offset = neighbor_index == -1 ? INTERNAL_OFFSET(&parent_node, 1) : 
@@ -1295,305 +2228,2250 @@ void delete_entry(int table_id, NodePage* node_page, uint64_t key) {
 	/* Coalescence. */
 
 	if (neighbor_page.num_keys + node_page->num_keys < capacity)
-		coalesce_nodes(table_id, node_page, &neighbor_page, neighbor_index, k_prime);
+		coalesce_nodes(table_id, path, level, node_page, &neighbor_page, neighbor_index, k_prime);
 
 	/* Redistribution. */
 
 	else
-		redistribute_nodes(table_id, node_page, &neighbor_page, neighbor_index, k_prime_index, k_prime);
-
-
+		redistribute_nodes(table_id, parent_node.file_offset, node_page, &neighbor_page, neighbor_index, k_prime_index, k_prime);
 }
 
-/* Master deletion function.
+/* Fewest entries a node below the root keeps before
+ * it is merged : half a node, or less under a lazy
+ * merge policy unless eager is set. Never under one,
+ * so an internal node is merged before its last child.
  */
-int delete(int table_id, uint64_t key) {
+static int merge_min_keys(NodePage* node_page, int eager) {
+    int min_keys, capacity;
 
-    char* value_found = NULL;
-    if ((value_found = find(table_id, key)) == 0) {
-        // This key is not in the tree
-        free(value_found);
-        return -1;
+    min_keys = node_page->is_leaf ? cut(order_leaf - 1) : cut(order_internal) - 1;
+    if (eager || merge_policy == MERGE_POLICY_EAGER) {
+        return min_keys;
     }
 
-    LeafPage leaf_node;
-    find_leaf(table_id, key, &leaf_node);
-
-    delete_entry(table_id, (NodePage*)&leaf_node, key);
+    if (merge_policy == MERGE_POLICY_THRESHOLD) {
+        capacity = node_page->is_leaf ? order_leaf - 1 : order_internal - 1;
+        if (capacity * merge_percent / 100 < min_keys) {
+            min_keys = capacity * merge_percent / 100;
+        }
+        return min_keys > 1 ? min_keys : 1;
+    }
 
-    return 0;
+    // Free-at-empty
+    return 1;
 }
 
-/* Project Buffer */
-int init_db(int num_buf){
-    int i;
-
-    // Auto intialize
+/* Restores the minimum fill along the path of key.
+ * Nodes are fixed from the top down, so the parent of an underfull
+ * node always has a neighbor for it : a node emptied down to one
+ * child is merged before its children are looked at.
+ */
+static void rebalance_path(int table_id, uint64_t key, int eager) {
+    int level = 1;
+    TreePath path;
+    LeafPage* leaf_node;
+    NodePage node_page;
+
+    while (dbheader[table_id - 1].root_offset != 0) {
+        // Case : root with a single child.
+        load_page_from_buffer(table_id, dbheader[table_id - 1].root_offset, (Page*)&node_page);
+        if (!node_page.is_leaf && node_page.num_keys == 0) {
+            adjust_root(table_id);
+            level = 1;
+            continue;
+        }
+
+        leaf_node = find_leaf_path(table_id, key, &path);
+        if (leaf_node == NULL) {
+            return;
+        }
+        buf_unpin((Page*)leaf_node, 0);
+        if (level >= path.height) {
+            return;
+        }
+
+        load_page_from_buffer(table_id, path.offsets[level], (Page*)&node_page);
+        if (node_page.num_keys >= merge_min_keys(&node_page, eager)) {
+            level++;
+            continue;
+        }
+
+        // The nodes above may change : start again from the root.
+        rebalance_node(table_id, &path, level, &node_page);
+        level = 1;
+    }
+}
+
+/* Deletes an entry from the B+ tree.
+ * Removes the record and its key and pointer
+ * from the leaf, and then makes all appropriate
+ * changes to preserve the B+ tree properties.
+ */
+void delete_entry(int table_id, TreePath* path, int level, NodePage* node_page, uint64_t key) {
+
+	int min_keys;
+
+	// Remove key and pointer from node.
+
+	remove_entry_from_node(table_id, node_page, key);
+	/* Case:  deletion from the root. 
+	 */
+
+	if (dbheader[table_id - 1].root_offset == node_page->file_offset) {
+		adjust_root(table_id);
+        return;
+    }
+
+	/* Case:  deletion from a node below the root.
+	 * (Rest of function body.)
+	 */
+
+	/* Determine minimum allowable size of node,
+	 * to be preserved after deletion.
+	 */
+
+	min_keys = merge_min_keys(node_page, 0);
+
+	/* Case:  node stays at or above minimum.
+	 * (The simple case.)
+	 */
+
+	if (node_page->num_keys >= min_keys)
+        return;
+	
+    /* Case:  node falls below minimum.
+	 * Either coalescence or redistribution
+	 * is needed.
+	 */
+
+	rebalance_node(table_id, path, level, node_page);
+}
+
+/* Master deletion function.
+ */
+int delete(int table_id, uint64_t key) {
+
+    int i;
+    LeafPage* leaf_node;
+    TreePath path;
+
+    engine_lock();
+    leaf_node = find_leaf_path(table_id, key, &path);
+    if (leaf_node == NULL) {
+        engine_unlock();
+        return -1;
+    }
+
+    i = LEAF_FIND(leaf_node, key);
+    if (i == -1) {
+        // This key is not in the tree
+        buf_unpin((Page*)leaf_node, 0);
+        engine_unlock();
+        return -1;
+    }
+
+    /* Case: the leaf stays at or above minimum (or is the root).
+     * Remove the record in place.
+     */
+    if (dbheader[table_id - 1].root_offset == leaf_node->file_offset ||
+            leaf_node->num_keys - 1 >= merge_min_keys((NodePage*)leaf_node, 0)) {
+        delete_entry(table_id, &path, path.height - 1, (NodePage*)leaf_node, key);
+        stats_remove_key(table_id, key);
+
+        // Case : merge deferred by the policy. Compacted later when idle.
+        if (dbheader[table_id - 1].root_offset != leaf_node->file_offset &&
+                leaf_node->num_keys < merge_min_keys((NodePage*)leaf_node, 1)) {
+            rebalance_queue_push(table_id, key, leaf_node->file_offset);
+        }
+        buf_unpin((Page*)leaf_node, 1);
+        engine_unlock();
+        return 0;
+    }
+
+    /* Case: coalescence or redistribution.
+     * The leaf page may be freed on the way, so work on a copy.
+     */
+    LeafPage leaf_copy;
+    memcpy(&leaf_copy, leaf_node, sizeof(LeafPage));
+    buf_unpin((Page*)leaf_node, 0);
+
+    delete_entry(table_id, &path, path.height - 1, (NodePage*)&leaf_copy, key);
+    stats_remove_key(table_id, key);
+
+    engine_unlock();
+    return 0;
+}
+
+/* Range delete */
+
+// Remember a page of a removed node. Pages are freed together at the end.
+static int delete_range_free(RangeDelete *rd, off_t offset, int is_leaf) {
+    off_t *freed;
+
+    if (rd->num_freed == rd->max_freed) {
+        freed = (off_t*)realloc(rd->freed, sizeof(off_t) * (rd->max_freed == 0 ? 64 : rd->max_freed * 2));
+        if (freed == NULL) {
+            return -1;
+        }
+        rd->freed = freed;
+        rd->max_freed = rd->max_freed == 0 ? 64 : rd->max_freed * 2;
+    }
+    rd->freed[rd->num_freed++] = offset;
+    rd->freed_leaves += is_leaf;
+    return 0;
+}
+
+// Drop a subtree inside the range. Only internal nodes are read :
+// the leaves are freed without loading them, and counted if they are in the pool.
+static int delete_range_subtree(RangeDelete *rd, off_t offset, int level) {
+    InternalPage* node;
+    LeafPage* leaf;
+    int i;
+
+    if (level < rd->leaf_level) {
+        node = (InternalPage*)buf_pin(rd->table_id, offset);
+        if (node == NULL) {
+            return -1;
+        }
+        for (i = 0; i <= node->num_keys; i++) {
+            if (delete_range_subtree(rd, INTERNAL_OFFSET(node, i), level + 1) == -1) {
+                buf_unpin((Page*)node, 0);
+                return -1;
+            }
+        }
+        buf_unpin((Page*)node, 0);
+    }
+    else if (page_table_lookup(rd->table_id, offset) != -1) {
+        leaf = (LeafPage*)buf_pin(rd->table_id, offset);
+        if (leaf != NULL) {
+            rd->deleted += leaf->num_keys;
+            buf_unpin((Page*)leaf, 0);
+        }
+    }
+    else {
+        rd->uncounted = 1;
+    }
+    return delete_range_free(rd, offset, level == rd->leaf_level);
+}
+
+/* Removes the keys of [lo, hi] under the node, whose keys are in [node_lo, node_hi].
+ * Children inside the range are dropped whole, the children crossing
+ * a bound of the range are trimmed recursively.
+ * Returns the number of records or children left, 0 if the node is empty
+ * (the caller frees it), -1 on failure.
+ */
+static int delete_range_node(RangeDelete *rd, off_t offset, int level, uint64_t node_lo, uint64_t node_hi) {
+    NodePage* page;
+    int i, j, n, kept, failed;
+    uint64_t child_lo, child_hi;
+
+    page = (NodePage*)buf_pin(rd->table_id, offset);
+    if (page == NULL) {
+        return -1;
+    }
+
+    // Case : leaf. Cut out the records of the range.
+    if (page->is_leaf) {
+        LeafPage* leaf = (LeafPage*)page;
+
+        i = LEAF_SEARCH(leaf, rd->lo);
+        j = search_upper(LEAF_KEYS(leaf), LEAF_KEY_STRIDE, leaf->num_keys, rd->hi);
+        if (j > i) {
+            n = leaf->num_keys - j;
+            memmove(&LEAF_KEY(leaf, i), &LEAF_KEY(leaf, j), sizeof(uint64_t) * n);
+            memmove(LEAF_VALUE(leaf, i), LEAF_VALUE(leaf, j), SIZE_VALUE * n);
+            // clear garbage records
+            memset(&LEAF_KEY(leaf, i + n), 0, sizeof(uint64_t) * (j - i));
+            memset(LEAF_VALUE(leaf, i + n), 0, SIZE_VALUE * (j - i));
+            leaf->num_keys -= j - i;
+            rd->deleted += j - i;
+        }
+        n = leaf->num_keys;
+        buf_unpin((Page*)leaf, j > i);
+        return n;
+    }
+
+    // Case : internal node. Compact the children left in place.
+    // The separator on the left of a kept child still bounds it.
+    InternalPage* node = (InternalPage*)page;
+    n = node->num_keys;
+    kept = 0;
+    for (i = 0; i <= n; i++) {
+        child_lo = i == 0 ? node_lo : INTERNAL_KEY(node, i - 1);
+        child_hi = i == n ? node_hi : INTERNAL_KEY(node, i) - 1;
+
+        // Case : child inside the range.
+        if (rd->lo <= child_lo && child_hi <= rd->hi) {
+            if (delete_range_subtree(rd, INTERNAL_OFFSET(node, i), level + 1) == -1) {
+                break;
+            }
+            continue;
+        }
+
+        // Case : child crossing a bound of the range.
+        if (child_hi >= rd->lo && child_lo <= rd->hi) {
+            j = delete_range_node(rd, INTERNAL_OFFSET(node, i), level + 1, child_lo, child_hi);
+            if (j == -1) {
+                break;
+            }
+            if (j == 0) {
+                if (delete_range_free(rd, INTERNAL_OFFSET(node, i), level + 1 == rd->leaf_level) == -1) {
+                    break;
+                }
+                continue;
+            }
+        }
+
+        if (kept > 0) {
+            INTERNAL_KEY(node, kept - 1) = INTERNAL_KEY(node, i - 1);
+        }
+        INTERNAL_OFFSET(node, kept) = INTERNAL_OFFSET(node, i);
+        kept++;
+    }
+
+    // Failure case : keep the children not visited yet.
+    failed = i <= n;
+    for (; i <= n; i++) {
+        if (kept > 0) {
+            INTERNAL_KEY(node, kept - 1) = INTERNAL_KEY(node, i - 1);
+        }
+        INTERNAL_OFFSET(node, kept) = INTERNAL_OFFSET(node, i);
+        kept++;
+    }
+
+    // clear garbage keys/pointers
+    for (i = kept; i <= n; i++) {
+        INTERNAL_KEY(node, i - 1) = 0;
+        INTERNAL_OFFSET(node, i) = 0;
+    }
+    node->num_keys = kept - 1;
+    buf_unpin((Page*)node, 1);
+    return failed ? -1 : kept;
+}
+
+/* Deletes the records with keys in [lo, hi].
+ * Subtrees inside the range are unlinked whole and
+ * their pages freed in one batch, the leaves on the
+ * bounds are trimmed, and the tree is rebalanced once
+ * along the two bounds at the end.
+ */
+int delete_range(int table_id, uint64_t lo, uint64_t hi) {
+    RangeDelete rd;
+    Cursor* cursor;
+    TreePath path;
+    LeafPage* left_leaf;
+    LeafPage* right_leaf;
+    const char* value;
+    uint64_t left_key = 0, right_key = 0;
+    int has_left = 0, has_right = 0, result;
+    off_t root_offset;
+
+    engine_lock();
+
+    // Failure case
+    if (table_id < 1 || table_id > 10 || dbfile[table_id - 1] <= 0) {
+        engine_unlock();
+        return -1;
+    }
+
+    root_offset = dbheader[table_id - 1].root_offset;
+    if (lo > hi || root_offset == 0) {
+        engine_unlock();
+        return 0;
+    }
+
+    // Nearest keys outside the range : their leaves are linked at the end.
+    if (lo > 0) {
+        cursor = cursor_open(table_id, 0, lo - 1, CURSOR_REVERSE);
+        if (cursor == NULL) {
+            engine_unlock();
+            return -1;
+        }
+        has_left = cursor_next(cursor, &left_key, &value) == 1;
+        cursor_close(cursor);
+    }
+    if (hi < UINT64_MAX) {
+        cursor = cursor_open(table_id, hi + 1, UINT64_MAX, CURSOR_FORWARD);
+        if (cursor == NULL) {
+            engine_unlock();
+            return -1;
+        }
+        has_right = cursor_next(cursor, &right_key, &value) == 1;
+        cursor_close(cursor);
+    }
+
+    // Height of the tree
+    left_leaf = find_leaf_path(table_id, lo, &path);
+    if (left_leaf == NULL) {
+        engine_unlock();
+        return -1;
+    }
+    buf_unpin((Page*)left_leaf, 0);
+
+    rd.table_id = table_id;
+    rd.lo = lo;
+    rd.hi = hi;
+    rd.leaf_level = path.height - 1;
+    rd.freed = NULL;
+    rd.num_freed = 0;
+    rd.max_freed = 0;
+    rd.freed_leaves = 0;
+    rd.deleted = 0;
+    rd.uncounted = 0;
+
+    result = delete_range_node(&rd, root_offset, 0, 0, UINT64_MAX);
+
+    // Case : every record was in the range.
+    if (result == 0) {
+        delete_range_free(&rd, root_offset, rd.leaf_level == 0);
+        dbheader[table_id - 1].root_offset = 0;
+        dbheader[table_id - 1].stats.height = 0;
+        flush_page_to_buffer(table_id, (Page*)(dbheader + table_id - 1));
+    }
+
+    put_free_pages(table_id, rd.freed, rd.num_freed);
+    stats_add_pages(table_id, -rd.freed_leaves, rd.freed_leaves - rd.num_freed, 0);
+    free(rd.freed);
+
+    // Records of dropped leaves out of the pool are unknown : count them again when asked.
+    if (result == -1 || (rd.uncounted && dbheader[table_id - 1].root_offset != 0)) {
+        dbheader[table_id - 1].stats_magic = 0;
+        stats_dirty[table_id - 1] = 1;
+    }
+    else {
+        stats_remove_keys(table_id, rd.deleted);
+    }
+
+    // The cached rightmost leaf may be freed.
+    rightmost_leaf[table_id - 1] = 0;
+
+    // Link the leaves on both sides of the range.
+    if (has_left) {
+        left_leaf = find_leaf_path(table_id, left_key, NULL);
+        right_leaf = has_right ? find_leaf_path(table_id, right_key, NULL) : NULL;
+        if (left_leaf != NULL && (right_leaf == NULL || right_leaf != left_leaf)) {
+            left_leaf->sibling = right_leaf == NULL ? 0 : right_leaf->file_offset;
+            buf_unpin((Page*)left_leaf, 1);
+        }
+        else if (left_leaf != NULL) {
+            buf_unpin((Page*)left_leaf, 0);
+        }
+        if (right_leaf != NULL) {
+            buf_unpin((Page*)right_leaf, 0);
+        }
+    }
+
+    // Single rebalancing pass along both bounds.
+    // Leaves the merge policy keeps underfull are compacted later when idle.
+    if (has_left) {
+        rebalance_path(table_id, left_key, 0);
+        rebalance_queue_push(table_id, left_key, 0);
+    }
+    if (has_right) {
+        rebalance_path(table_id, right_key, 0);
+        rebalance_queue_push(table_id, right_key, 0);
+    }
+    stats_refresh_bounds(table_id);
+
+    engine_unlock();
+    return result == -1 ? -1 : 0;
+}
+
+/* Project Buffer */
+int init_db(int num_buf){
+    return init_db_policy(num_buf, BUF_POLICY_CLOCK);
+}
+
+int init_db_policy(int num_buf, int policy){
+    return init_db_ex(num_buf, policy, 0);
+}
+
+// Frames : mmap arenas, so a frame pointer maps back to its index.
+static Page* alloc_frame_arena(int num_buf, int flags, size_t *arena_size){
+    size_t size = (size_t)num_buf * sizeof(Page);
+    uintptr_t start, aligned;
+    char *arena = MAP_FAILED;
+
+    // Case : explicit huge pages. Needs pages reserved in vm.nr_hugepages.
+    if(flags & BUF_FLAG_HUGE_PAGES){
+        *arena_size = (size + BUF_HUGE_PAGE_SIZE - 1) & ~(size_t)(BUF_HUGE_PAGE_SIZE - 1);
+        arena = mmap(NULL, *arena_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(arena != MAP_FAILED){
+            return (Page*)arena;
+        }
+
+        // Fallback : transparent huge pages on a huge page aligned range.
+        arena = mmap(NULL, *arena_size + BUF_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(arena == MAP_FAILED){
+            return NULL;
+        }
+        start = (uintptr_t)arena;
+        aligned = (start + BUF_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(BUF_HUGE_PAGE_SIZE - 1);
+        if(aligned > start){
+            munmap(arena, aligned - start);
+        }
+        munmap((char*)aligned + *arena_size, BUF_HUGE_PAGE_SIZE - (aligned - start));
+        madvise((char*)aligned, *arena_size, MADV_HUGEPAGE);
+
+        return (Page*)aligned;
+    }
+
+    // Case : regular pages.
+    *arena_size = size;
+    arena = mmap(NULL, *arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return arena == MAP_FAILED ? NULL : (Page*)arena;
+}
+// Map frames [first, first + count) as a new segment.
+static int add_frame_segment(int first, int count){
+    FrameSegment *segment;
+    int i;
+
+    if(num_buf_segments == BUF_MAX_SEGMENTS){
+        return -1;
+    }
+
+    segment = &buf_segments[num_buf_segments];
+    segment->frames = alloc_frame_arena(count, buf_flags, &segment->size);
+    if(segment->frames == NULL){
+        return -1;
+    }
+    segment->first = first;
+    segment->count = count;
+    num_buf_segments++;
+
+    for(i = 0; i < count; i++){
+        buf_mgr[first + i].frame = segment->frames + i;
+    }
+
+    return 0;
+}
+
+// Page table for num_buf frames : power of two buckets, at least twice the number of frames.
+static int* alloc_page_table(int num_buf, int *mask){
+    int *table, buckets = 1, i;
+
+    while(buckets < num_buf * 2){
+        buckets <<= 1;
+    }
+    table = (int *)malloc(buckets * sizeof(int));
+    if(table == NULL){
+        return NULL;
+    }
+    for(i = 0; i < buckets; i++){
+        table[i] = -1;
+    }
+    *mask = buckets - 1;
+
+    return table;
+}
+// Release the buffer pool : frames, page table, free frame list and policy state.
+static void free_buffer_pool(void){
+    int i;
+
+    buf_policy->destroy();
+    free(free_frames);
+    free_frames = NULL;
+    num_free_frames = 0;
+    for(i = 0; i < num_buf_segments; i++){
+        munmap(buf_segments[i].frames, buf_segments[i].size);
+    }
+    num_buf_segments = 0;
+    free(buf_mgr);
+    buf_mgr = NULL;
+    free(page_table);
+    page_table = NULL;
+    buf_size = -1;
+}
+
+int init_db_ex(int num_buf, int policy, int flags){
+    int i;
+
+    buf_policy = get_replacement_policy(policy);
+    if(num_buf < 1 || buf_policy == NULL){
+        return -1;
+    }
+
+    direct_io = (flags & BUF_FLAG_DIRECT_IO) != 0;
+    search_init();
+    reset_buffer_stats();
+
+    // Auto intialize
     buf_mgr = (Buffer *)calloc(num_buf, sizeof(Buffer)); 
 
-    for(i = 0; i < num_buf; i++){
-        buf_mgr[i].frame = (Page*)malloc(sizeof(Page));
+    if(buf_mgr == NULL){
+        /* Fail */
+        return -1;
+    }
+
+    // Frames are kept apart from the Buffer array : clock sweeps only touch Buffer.
+    // Failure case : release what was allocated, the engine stays down.
+    buf_flags = flags;
+    if(add_frame_segment(0, num_buf) != 0){
+        free_buffer_pool();
+        return -1;
+    }
+
+    page_table = alloc_page_table(num_buf, &page_table_mask);
+    if(page_table == NULL){
+        free_buffer_pool();
+        return -1;
+    }
+
+    // Every frame starts free. Frame 0 is handed out first.
+    free_frames = (int *)malloc(num_buf * sizeof(int));
+    if(free_frames == NULL){
+        free_buffer_pool();
+        return -1;
+    }
+    for(i = 0; i < num_buf; i++){
+        free_frames[i] = num_buf - 1 - i;
+    }
+    num_free_frames = num_buf;
+
+    if(buf_policy->init(num_buf) != 0){
+        free_buffer_pool();
+        return -1;
+    }
+
+    /* Success */
+    // Memory allocation
+    buf_size = num_buf;
+
+    /* Recovery procedure */
+    log = open("log.db", O_RDWR);
+
+    // Case 1 : Log file doesn't exist. Keep going
+
+    // Case 2 : Log file exists. Do recovery.
+    if(log > 0){
+        recovery();
+
+        // Remove log file. & Reinitialize
+        close(log);
+        remove("log.db");
+        log = -1;
+    }
+
+    /* Warm start : pages are preloaded when their table is opened */
+    load_warm_list();
+
+    return 0;
+}
+
+// Write back dirty frames of a table, or of every table if table_id is 0.
+// Pages are written in file order, each file is synced once.
+static void flush_dirty_frames(int table_id){
+    PageIO *ios;
+    int i, count = 0, page_lsn, max_lsn = 0;
+
+    ios = (PageIO *)malloc(buf_size * sizeof(PageIO));
+
+    for(i = 0; i < buf_size; i++){
+        if(buf_mgr[i].is_dirty != 1 || buf_mgr[i].table_id < 1 ||
+                (table_id != 0 && buf_mgr[i].table_id != table_id)){
+            continue;
+        }
+
+        // WAL : log records of the pages reach the log file first.
+        if(exclude_header(i)){
+            page_lsn = exclude_internal(i);
+            if(page_lsn > max_lsn){
+                max_lsn = page_lsn;
+            }
+        }
+
+        // No memory for the batch : write the page now.
+        if(ios == NULL){
+            if(max_lsn > 0){
+                execute_wal(max_lsn);
+            }
+            flush_page(buf_mgr[i].table_id, buf_mgr[i].frame);
+        }
+        else{
+            ios[count].table_id = buf_mgr[i].table_id;
+            ios[count].page = buf_mgr[i].frame;
+            count++;
+        }
+        buf_mgr[i].is_dirty = 0;
+    }
+
+    if(ios != NULL){
+        if(max_lsn > 0){
+            execute_wal(max_lsn);
+        }
+        writeback_pages(ios, count);
+        free(ios);
+    }
+}
+
+/* Leaf format upgrade */
+// Rewrite the leaves of a LEAF_FORMAT_RECORDS file in the SoA layout, walking the leaf chain.
+// Leaves reach the file before the header says the file is converted.
+static void upgrade_leaf_format(int table_id){
+    HeaderPage *header = &dbheader[table_id - 1];
+    RecordLeafPage old;
+    NodePage *page;
+    LeafPage *leaf;
+    off_t offset, next;
+    int i, dirty;
+
+    if(header->leaf_format == LEAF_FORMAT_SOA){
+        return;
+    }
+
+    // Leftmost leaf
+    offset = header->root_offset;
+    while(offset != 0){
+        page = (NodePage*)buf_pin(table_id, offset);
+        if(page == NULL){
+            return;
+        }
+        next = page->is_leaf ? 0 : INTERNAL_OFFSET((InternalPage*)page, 0);
+        buf_unpin((Page*)page, 0);
+        if(next == 0){
+            break;
+        }
+        offset = next;
+    }
+
+    while(offset != 0){
+        leaf = (LeafPage*)buf_pin(table_id, offset);
+        if(leaf == NULL){
+            return;
+        }
+
+        // Case : leaf converted before an interrupted upgrade.
+        dirty = 0;
+        if(leaf->format != LEAF_SOA_MAGIC){
+            memcpy(&old, leaf, sizeof(RecordLeafPage));
+            memset(leaf->keys, 0, sizeof(leaf->keys) + sizeof(leaf->values));
+            for(i = 0; i < old.num_keys; i++){
+                LEAF_KEY(leaf, i) = old.records[i].key;
+                memcpy(LEAF_VALUE(leaf, i), old.records[i].value, SIZE_VALUE);
+            }
+            leaf->format = LEAF_SOA_MAGIC;
+            dirty = 1;
+        }
+
+        offset = leaf->sibling;
+        buf_unpin((Page*)leaf, dirty);
+    }
+    flush_dirty_frames(table_id);
+
+    header->leaf_format = LEAF_FORMAT_SOA;
+    flush_page_to_buffer(table_id, (Page*)header);
+    flush_dirty_frames(table_id);
+}
+
+int close_table(int table_id){
+    int i;
+
+    engine_lock();
+
+    // Failure case
+    if(table_id < 1 || table_id > 10 || buf_size == -1 || buf_mgr == NULL){
+        engine_unlock();
+        return -1;
+    }
+
+    // Pages of the table may be written by the background writer right now.
+    wait_bg_writer();
+
+    // Write dirty pages of the table with one batch.
+    flush_dirty_frames(table_id);
+
+    for(i = 0; i < buf_size; i++){
+        if(buf_mgr[i].table_id == table_id){
+            // Reinitialize : Evict
+            clear_frame(i);
+        }
+    }
+
+    // Checkpoint once no table has dirty pages, unless a transaction may still roll back.
+    if(!in_transaction){
+        checkpoint_log();
+    }
+    
+    // Close file
+    close_db(table_id);
+
+    // Reinitialize dbfile
+    dbfile[table_id - 1] = 0;
+    rightmost_leaf[table_id - 1] = 0;
+
+    engine_unlock();
+    return 0;
+}
+
+int shutdown_db(){
+    // Background threads work on the buffer pool : stop them before destroying.
+    stop_bg_writer();
+    stop_bg_rebalancer();
+
+    engine_lock();
+
+    // Failure case
+    if(buf_size == -1 || buf_mgr == NULL){
+        engine_unlock();
+        return -1;
+    }
+
+    // Remember resident pages for the next start, if warm start is on.
+    if(warm_file != NULL){
+        dump_buffer_pool();
+    }
+
+    // Write every dirty page with one batch.
+    flush_dirty_frames(0);
+    // An open transaction ends here : its changes stay, as they did before.
+    checkpoint_log();
+    in_transaction = 0;
+    page_io_destroy();
+
+    // Destroy allocated buffer
+    free_buffer_pool();
+    free(warm_pages);
+    warm_pages = NULL;
+    num_warm_pages = 0;
+    rb_head = 0;
+    rb_count = 0;
+    memset(rb_sweep, 0, sizeof(rb_sweep));
+
+    engine_unlock();
+    return 0;
+}
+/* Buffer resize */
+// A resize allocates everything it needs before it moves a page : on failure the pool is unchanged.
+// Allocate the page table and the replacement policy state for num_buf frames.
+// The policy state is replaced on success : commit_buffer_index must follow.
+static int prepare_buffer_index(int num_buf, int **table, int *mask){
+    *table = alloc_page_table(num_buf, mask);
+    if(*table == NULL){
+        return -1;
+    }
+    if(buf_policy->init(num_buf) != 0){
+        free(*table);
+        return -1;
+    }
+
+    return 0;
+}
+// Register the pages of the resized pool in the new page table and policy.
+// Reference bits are kept. History of LRU-K, 2Q and ARC starts over.
+static void commit_buffer_index(int *table, int mask){
+    int i, refbit;
+
+    free(page_table);
+    page_table = table;
+    page_table_mask = mask;
+
+    for(i = 0; i < buf_size; i++){
+        // Free frame is never registered.
+        if(buf_mgr[i].table_id == 0){
+            continue;
+        }
+        page_table_insert(i);
+        // Frames of a scan ring are not managed by the policy.
+        if(buf_mgr[i].ring_id == 0){
+            refbit = buf_mgr[i].refbit;
+            buf_policy->fill(i);
+            buf_mgr[i].refbit = refbit;
+        }
+    }
+}
+static int grow_buffer(int num_buf){
+    FrameSegment *last;
+    Buffer *mgr;
+    int *frames, *table, i, spare, mask, added;
+
+    mgr = (Buffer *)realloc(buf_mgr, num_buf * sizeof(Buffer));
+    if(mgr == NULL){
+        return -1;
+    }
+    buf_mgr = mgr;
+    memset(buf_mgr + buf_size, 0, (num_buf - buf_size) * sizeof(Buffer));
+
+    frames = (int *)realloc(free_frames, num_buf * sizeof(int));
+    if(frames == NULL){
+        return -1;
+    }
+    free_frames = frames;
+
+    // Case : last segment still maps frames given up by a shrink. Use them first.
+    last = &buf_segments[num_buf_segments - 1];
+    spare = (int)(last->size / sizeof(Page)) - last->count;
+    if(spare > num_buf - buf_size){
+        spare = num_buf - buf_size;
+    }
+    for(i = 0; i < spare; i++){
+        buf_mgr[buf_size + i].frame = last->frames + last->count + i;
+        memset(buf_mgr[buf_size + i].frame, 0, sizeof(Page));
+    }
+    last->count += spare;
+
+    // Case : new frames in a new segment.
+    added = buf_size + spare < num_buf;
+    if(added && add_frame_segment(buf_size + spare, num_buf - buf_size - spare) != 0){
+        last->count -= spare;
+        return -1;
+    }
+
+    // Failure case : the new frames were never used. Give them back.
+    if(prepare_buffer_index(num_buf, &table, &mask) != 0){
+        if(added){
+            num_buf_segments--;
+            munmap(buf_segments[num_buf_segments].frames, buf_segments[num_buf_segments].size);
+        }
+        last->count -= spare;
+        return -1;
+    }
+
+    // New frames are free. The lowest one is handed out first.
+    for(i = num_buf - 1; i >= buf_size; i--){
+        free_frames[num_free_frames++] = i;
+    }
+    buf_size = num_buf;
+    commit_buffer_index(table, mask);
+
+    return 0;
+}
+static int shrink_buffer(int num_buf){
+    FrameSegment *segment;
+    PageIO *ios;
+    Buffer *mgr;
+    int *frames, *table, i, target, mask, count = 0, num_free = 0, page_lsn, max_lsn = 0;
+    uintptr_t start, end, page_mask;
+
+    // Removed frames must not be in use : pinned, in a scan ring or holding join output.
+    for(i = num_buf; i < buf_size; i++){
+        if(buf_mgr[i].pin_count > 0 || buf_mgr[i].ring_id != 0 || buf_mgr[i].table_id < 0){
+            return -1;
+        }
+    }
+
+    ios = (PageIO *)malloc((buf_size - num_buf) * sizeof(PageIO));
+    if(ios == NULL){
+        return -1;
+    }
+    if(prepare_buffer_index(num_buf, &table, &mask) != 0){
+        free(ios);
+        return -1;
+    }
+
+    // Nothing fails from here : pages are moved or written back, then frames are released.
+
+    // Only free frames below the new size are kept.
+    for(i = 0; i < num_free_frames; i++){
+        if(free_frames[i] < num_buf){
+            free_frames[num_free++] = free_frames[i];
+        }
+    }
+    num_free_frames = num_free;
+
+    for(i = num_buf; i < buf_size; i++){
+        if(buf_mgr[i].table_id == 0){
+            continue;
+        }
+
+        // Case : free frame left below the new size. Move the page there.
+        if(num_free_frames > 0){
+            target = free_frames[--num_free_frames];
+            memcpy(buf_mgr[target].frame, buf_mgr[i].frame, sizeof(Page));
+            buf_mgr[target].table_id = buf_mgr[i].table_id;
+            buf_mgr[target].page_offset = buf_mgr[i].page_offset;
+            buf_mgr[target].is_dirty = buf_mgr[i].is_dirty;
+            buf_mgr[target].refbit = buf_mgr[i].refbit;
+            continue;
+        }
+
+        // Case : no room. Evict, writing back the dirty page.
+        STATS_ADD(buf_mgr[i].table_id, evictions, 1);
+        if(buf_mgr[i].is_dirty == 1){
+            STATS_ADD(buf_mgr[i].table_id, dirty_evictions, 1);
+            // WAL : log records of the pages reach the log file first.
+            if(exclude_header(i)){
+                page_lsn = exclude_internal(i);
+                if(page_lsn > max_lsn){
+                    max_lsn = page_lsn;
+                }
+            }
+            ios[count].table_id = buf_mgr[i].table_id;
+            ios[count].page = buf_mgr[i].frame;
+            count++;
+        }
+    }
+
+    if(max_lsn > 0){
+        execute_wal(max_lsn);
+    }
+    writeback_pages(ios, count);
+    free(ios);
+
+    // Give memory of the removed frames back. Mapping of a partly used segment is kept for growing again.
+    page_mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+    for(i = num_buf_segments - 1; i >= 0; i--){
+        segment = &buf_segments[i];
+        if(segment->first >= num_buf){
+            munmap(segment->frames, segment->size);
+            num_buf_segments--;
+        }
+        else if(segment->first + segment->count > num_buf){
+            segment->count = num_buf - segment->first;
+            start = ((uintptr_t)(segment->frames + segment->count) + page_mask) & ~page_mask;
+            end = (uintptr_t)segment->frames + segment->size;
+            if(end > start){
+                madvise((void*)start, end - start, MADV_DONTNEED);
+            }
+        }
+    }
+
+    buf_size = num_buf;
+    mgr = (Buffer *)realloc(buf_mgr, num_buf * sizeof(Buffer));
+    if(mgr != NULL){
+        buf_mgr = mgr;
+    }
+    frames = (int *)realloc(free_frames, num_buf * sizeof(int));
+    if(frames != NULL){
+        free_frames = frames;
+    }
+    commit_buffer_index(table, mask);
+
+    return 0;
+}
+// Frames are added or removed under the engine latch : no page is read or copied
+// while growing, so lookups stall only for the page table and policy rebuild.
+int resize_buffer(int num_buf){
+    int result = 0;
+
+    engine_lock();
+
+    // Failure case
+    if(buf_size == -1 || buf_mgr == NULL || num_buf < 1){
+        engine_unlock();
+        return -1;
+    }
+
+    // Frames of the batch being written by the background writer are pinned.
+    wait_bg_writer();
+
+    if(num_buf > buf_size){
+        result = grow_buffer(num_buf);
+    }
+    else if(num_buf < buf_size){
+        result = shrink_buffer(num_buf);
+    }
+
+    engine_unlock();
+    return result;
+}
+// Load function
+void load_page_from_buffer(int table_id, off_t offset, Page* page){
+    Page *temp;
+    int buf_index = -1;
+
+    temp = check_buffer_for_load(table_id, offset);
+
+    // Page is in buffer pool.
+    if(temp != NULL){
+        // Load page from buffer pool.
+        memcpy(page, temp, sizeof(Page));
+        page->file_offset = offset;
+
+        /* Turn ref bit on */
+        // Previously done in is_in_buffer function
+    }
+    // Page is not in buffer pool.
+    else{
+        buf_index = replace_page(NULL);
+
+        // Load from disk.
+        load_page(table_id, offset, page);
+        page->file_offset = offset; 
+
+        /* Busy buffer pool : every frame is pinned */
+        if(buf_index == -1){
+            return;
+        }
+
+        /* Not busy buffer pool */
+        // In case of busy buffer pool, just load page from disk.
+        /* Setting new buffer */ 
+        // Page index is set already in replace_page function.
+        // Memory allocation & Memory copy
+        memcpy(buf_mgr[buf_index].frame, page, sizeof(Page));
+        install_frame(buf_index, table_id, offset, 0);
+    }
+}
+Page* check_buffer_for_load(int table_id, off_t offset){
+    int index;
+
+    if(buf_size == -1){
+        // Error case 
+        return NULL;
+    }
+
+    index = page_table_lookup(table_id, offset);
+
+    // Unmatched case
+    if(index == -1){
+        STATS_ADD(table_id, misses, 1);
+        return NULL;
+    }
+    STATS_ADD(table_id, hits, 1);
+
+    adopt_frame(index);
+    buf_policy->hit(index);
+
+    return buf_mgr[index].frame;
+}
+int check_buffer_for_flush(int table_id, off_t offset){
+    int index;
+
+    if(buf_size == -1){
+        // Error case 
+        return -1;
+    }
+
+    index = page_table_lookup(table_id, offset);
+
+    // Unmatched case
+    if(index == -1){
+        STATS_ADD(table_id, misses, 1);
+        return -1;
+    }
+    STATS_ADD(table_id, hits, 1);
+
+    adopt_frame(index);
+    buf_policy->hit(index);
+
+    return index;
+}
+/* Page table */
+// Bucket of a page : table id and page number mixed with multiplicative hashing.
+static int page_table_hash(int table_id, off_t offset){
+    uint64_t h;
+
+    h = (uint64_t)(offset / PAGE_SIZE) * 0x9E3779B97F4A7C15ULL;
+    h ^= (uint64_t)(int64_t)table_id * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 29;
+
+    return (int)(h & page_table_mask);
+}
+// Return buffer index holding the page, -1 if the page is not resident.
+int page_table_lookup(int table_id, off_t offset){
+    int index;
+
+    index = page_table[page_table_hash(table_id, offset)];
+    while(index != -1){
+        if(buf_mgr[index].table_id == table_id && buf_mgr[index].page_offset == offset){
+            return index;
+        }
+        index = buf_mgr[index].hash_next;
+    }
+
+    return -1;
+}
+// Register a frame whose table_id and page_offset are already set.
+void page_table_insert(int buf_index){
+    int bucket;
+
+    bucket = page_table_hash(buf_mgr[buf_index].table_id, buf_mgr[buf_index].page_offset);
+    buf_mgr[buf_index].hash_next = page_table[bucket];
+    page_table[bucket] = buf_index;
+}
+// Unlink a frame from its bucket chain. Must be called before the frame is reset.
+void page_table_remove(int buf_index){
+    int *link;
+
+    link = &page_table[page_table_hash(buf_mgr[buf_index].table_id, buf_mgr[buf_index].page_offset)];
+    while(*link != -1){
+        if(*link == buf_index){
+            *link = buf_mgr[buf_index].hash_next;
+            break;
+        }
+        link = &buf_mgr[*link].hash_next;
+    }
+    buf_mgr[buf_index].hash_next = -1;
+}
+// Setting new buffer : register the page in the page table and the policy.
+void install_frame(int buf_index, int table_id, off_t offset, int is_dirty){
+    buf_mgr[buf_index].table_id = table_id;
+    buf_mgr[buf_index].page_offset = offset;
+    buf_mgr[buf_index].is_dirty = is_dirty;
+    page_table_insert(buf_index);
+    buf_policy->fill(buf_index);
+}
+static void reset_frame(int buf_index){
+    memset(buf_mgr[buf_index].frame, 0, sizeof(Page));
+    buf_mgr[buf_index].table_id = 0;
+    buf_mgr[buf_index].page_offset = 0;
+    buf_mgr[buf_index].is_dirty = 0;
+    buf_mgr[buf_index].refbit = 0;
+    buf_mgr[buf_index].pin_count = 0;
+    buf_mgr[buf_index].ring_id = 0;
+}
+// Reinitialize : Evict, and give the frame back to the free frame list.
+void clear_frame(int buf_index){
+    // Free frame is never registered in the page table.
+    if(buf_mgr[buf_index].table_id == 0){
+        return;
+    }
+
+    page_table_remove(buf_index);
+    buf_policy->remove(buf_index, 0);
+    reset_frame(buf_index);
+
+    free_frames[num_free_frames++] = buf_index;
+}
+int frame_evictable(int buf_index, FILE *file){
+    // Free frame, pinned frame or frame owned by a scan ring
+    if(buf_mgr[buf_index].table_id == 0 || buf_mgr[buf_index].pin_count > 0 || buf_mgr[buf_index].ring_id != 0){
+        return 0;
+    }
+    // Output buffer without its result file
+    if(buf_mgr[buf_index].table_id == -1 && file == NULL){
+        return 0;
+    }
+    return 1;
+}
+/* Pin function */
+// Work on the frame in place instead of copying it out.
+Page* buf_pin(int table_id, off_t offset){
+    int buf_index;
+
+    buf_index = check_buffer_for_flush(table_id, offset);
+
+    // Page is not in buffer pool.
+    if(buf_index == -1){
+        buf_index = replace_page(NULL);
+
+        // Busy buffer pool : every frame is pinned
+        if(buf_index == -1){
+            return NULL;
+        }
+
+        // Load from disk directly into the frame.
+        load_page(table_id, offset, buf_mgr[buf_index].frame);
+        install_frame(buf_index, table_id, offset, 0);
+    }
+
+    buf_mgr[buf_index].pin_count++;
+
+    return buf_mgr[buf_index].frame;
+}
+/* Unpin function */
+void buf_unpin(Page* frame, int dirty){
+    int buf_index;
+
+    buf_index = buf_frame_index(frame);
+    if(buf_index == -1 || buf_mgr[buf_index].pin_count == 0){
+        // Error case : not a pinned frame
+        return;
+    }
+
+    if(dirty){
+        buf_mgr[buf_index].is_dirty = 1;
+    }
+    buf_mgr[buf_index].pin_count--;
+}
+int buf_frame_index(Page* page){
+    uintptr_t base, target;
+    int i;
+
+    target = (uintptr_t)page;
+    for(i = 0; i < num_buf_segments; i++){
+        base = (uintptr_t)buf_segments[i].frames;
+        if(target >= base && target < base + (uintptr_t)buf_segments[i].count * sizeof(Page)){
+            return buf_segments[i].first + (int)((target - base) / sizeof(Page));
+        }
+    }
+
+    return -1;
+}
+// Page of a scan ring is used outside the scan : move it to the shared pool.
+void adopt_frame(int buf_index){
+    if(buf_mgr[buf_index].ring_id != 0){
+        buf_mgr[buf_index].ring_id = 0;
+        buf_policy->fill(buf_index);
+    }
+}
+/* Buffer access strategy */
+void buf_ring_init(BufferRing *ring){
+    // Keep most of a small buffer pool for the shared pages.
+    ring->size = buf_size / 4 < BUF_RING_SIZE ? buf_size / 4 : BUF_RING_SIZE;
+    if(ring->size < 1){
+        ring->size = 1;
+    }
+    ring->id = ++last_ring_id;
+    ring->used = 0;
+    ring->current = 0;
+}
+// Write back a page held by a ring frame and detach it from the page table.
+static void recycle_ring_frame(int buf_index){
+    int page_lsn;
+
+    STATS_ADD(buf_mgr[buf_index].table_id, evictions, 1);
+    if(buf_mgr[buf_index].is_dirty == 1){
+        STATS_ADD(buf_mgr[buf_index].table_id, dirty_evictions, 1);
+        // Before flush page, excute WAL protocol
+        if(exclude_header(buf_index)){
+            page_lsn = exclude_internal(buf_index);
+            if(page_lsn > 0){
+                execute_wal(page_lsn);
+            }
+        }
+        flush_page(buf_mgr[buf_index].table_id, buf_mgr[buf_index].frame);
+    }
+    page_table_remove(buf_index);
+    reset_frame(buf_index);
+}
+// Take a frame for the ring : grow the ring or recycle its oldest unpinned frame.
+// Return -1 if every frame of the ring is pinned or no frame is available.
+static int ring_take_frame(BufferRing *ring){
+    int i, slot, buf_index = -1;
+
+    // Case : ring is full. Recycle the oldest unpinned frame of the ring.
+    if(ring->used == ring->size){
+        for(i = 0; i < ring->size; i++){
+            slot = (ring->current + i) % ring->size;
+            if(buf_mgr[ring->frames[slot]].ring_id != ring->id){
+                // Frame was taken by the shared pool : get another one.
+                buf_index = replace_page(NULL);
+                if(buf_index == -1){
+                    return -1;
+                }
+                ring->frames[slot] = buf_index;
+                break;
+            }
+            if(buf_mgr[ring->frames[slot]].pin_count == 0){
+                buf_index = ring->frames[slot];
+                recycle_ring_frame(buf_index);
+                break;
+            }
+        }
+        if(buf_index != -1){
+            ring->current = (slot + 1) % ring->size;
+        }
+        return buf_index;
+    }
+
+    // Case : ring is growing. Take a frame from the shared pool.
+    buf_index = replace_page(NULL);
+    if(buf_index != -1){
+        ring->frames[ring->used++] = buf_index;
+    }
+    return buf_index;
+}
+// Register a page loaded into a ring frame. The policy never sees it.
+static void install_ring_frame(BufferRing *ring, int buf_index, int table_id, off_t offset){
+    buf_mgr[buf_index].table_id = table_id;
+    buf_mgr[buf_index].page_offset = offset;
+    buf_mgr[buf_index].is_dirty = 0;
+    buf_mgr[buf_index].ring_id = ring->id;
+    page_table_insert(buf_index);
+}
+Page* buf_pin_ring(BufferRing *ring, int table_id, off_t offset){
+    int buf_index;
+
+    // Page is in buffer pool : use it without touching the replacement policy.
+    buf_index = page_table_lookup(table_id, offset);
+    if(buf_index != -1){
+        STATS_ADD(table_id, hits, 1);
+        buf_mgr[buf_index].pin_count++;
+        return buf_mgr[buf_index].frame;
+    }
+
+    // Every frame of the ring is pinned : use the shared pool.
+    buf_index = ring_take_frame(ring);
+    if(buf_index == -1){
+        return buf_pin(table_id, offset);
+    }
+    STATS_ADD(table_id, misses, 1);
+
+    // Load from disk directly into the frame.
+    load_page(table_id, offset, buf_mgr[buf_index].frame);
+    install_ring_frame(ring, buf_index, table_id, offset);
+    buf_mgr[buf_index].pin_count = 1;
+
+    return buf_mgr[buf_index].frame;
+}
+int buf_ring_prefetch(BufferRing *ring, int table_id, off_t *offsets, int count){
+    PageIO ios[BUF_RING_SIZE];
+    int i, num_ios = 0, buf_index;
+
+    for(i = 0; i < count && num_ios < ring->size; i++){
+        if(page_table_lookup(table_id, offsets[i]) != -1){
+            continue;
+        }
+        buf_index = ring_take_frame(ring);
+        if(buf_index == -1){
+            break;
+        }
+        // Pinned while the batch is built : the ring must not recycle it.
+        buf_mgr[buf_index].pin_count = 1;
+        ios[num_ios].table_id = table_id;
+        ios[num_ios].offset = offsets[i];
+        ios[num_ios].page = buf_mgr[buf_index].frame;
+        num_ios++;
+    }
+
+    load_pages(ios, num_ios);
+
+    for(i = 0; i < num_ios; i++){
+        buf_index = buf_frame_index(ios[i].page);
+        install_ring_frame(ring, buf_index, table_id, ios[i].offset);
+        buf_mgr[buf_index].pin_count = 0;
+    }
+
+    return num_ios;
+}
+int buf_prefetch(int table_id, off_t *offsets, int count){
+    PageIO ios[PAGE_IO_QUEUE_DEPTH];
+    int i, num_ios = 0, buf_index;
+
+    for(i = 0; i < count && num_ios < PAGE_IO_QUEUE_DEPTH; i++){
+        if(page_table_lookup(table_id, offsets[i]) != -1){
+            continue;
+        }
+        // Frame is not in the page table yet : replace_page never returns it twice.
+        buf_index = replace_page(NULL);
+        if(buf_index == -1){
+            break;
+        }
+        ios[num_ios].table_id = table_id;
+        ios[num_ios].offset = offsets[i];
+        ios[num_ios].page = buf_mgr[buf_index].frame;
+        num_ios++;
+    }
+
+    load_pages(ios, num_ios);
+
+    for(i = 0; i < num_ios; i++){
+        install_frame(buf_frame_index(ios[i].page), table_id, ios[i].offset, 0);
+    }
+
+    return num_ios;
+}
+void buf_ring_free(BufferRing *ring){
+    int i, buf_index;
+
+    for(i = 0; i < ring->used; i++){
+        buf_index = ring->frames[i];
+        if(buf_mgr[buf_index].ring_id != ring->id){
+            continue;
+        }
+
+        // Still pinned : the page stays in the shared pool.
+        if(buf_mgr[buf_index].pin_count > 0){
+            adopt_frame(buf_index);
+            continue;
+        }
+
+        recycle_ring_frame(buf_index);
+        free_frames[num_free_frames++] = buf_index;
+    }
+    ring->used = 0;
+}
+/* Read-ahead */
+void readahead_init(ReadAhead *ra, int table_id, BufferRing *ring){
+    ra->table_id = table_id;
+    ra->ring = ring;
+    // Direct I/O : pages are read into the ring. Half of it holds the pages ahead.
+    ra->limit = direct_io ? ring->size / 2 : READAHEAD_MAX;
+    ra->window = ra->limit < READAHEAD_MIN ? ra->limit : READAHEAD_MIN;
+    ra->count = 0;
+    ra->next = 0;
+}
+// Collect offsets of the leaves following the leaf which holds key, in key order.
+// Parents of the leaves are reached from the root : leaves are never read here.
+static int readahead_collect(int table_id, uint64_t key, off_t *offsets, int max){
+    int i, depth, height = -1, count = 0, first = 1, has_fence;
+    uint64_t fence = 0;
+    NodePage *page, *child;
+    InternalPage *internal_node;
+
+    while(count < max){
+        if(dbheader[table_id - 1].root_offset == 0){
+            break;
+        }
+        page = (NodePage*)buf_pin(table_id, dbheader[table_id - 1].root_offset);
+        if(page == NULL){
+            break;
+        }
+        // Case : root is a leaf. Nothing to predict.
+        if(page->is_leaf){
+            buf_unpin((Page*)page, 0);
+            break;
+        }
+
+        // Descend to the parent of the leaves.
+        // Remember the smallest separator above key : it leads to the next parent.
+        depth = 0;
+        has_fence = 0;
+        while(1){
+            internal_node = (InternalPage*)page;
+            i = INTERNAL_SEARCH(internal_node, key);
+            if(depth + 1 == height){
+                break;
+            }
+
+            // First descent : the child is the scanned leaf, already in the pool.
+            child = (NodePage*)buf_pin(table_id, INTERNAL_OFFSET(internal_node, i));
+            if(child == NULL){
+                buf_unpin((Page*)page, 0);
+                return count;
+            }
+            if(child->is_leaf){
+                height = depth + 1;
+                buf_unpin((Page*)child, 0);
+                break;
+            }
+            if(i < internal_node->num_keys){
+                fence = INTERNAL_KEY(internal_node, i);
+                has_fence = 1;
+            }
+            buf_unpin((Page*)page, 0);
+            page = child;
+            depth++;
+        }
+
+        // Leaves right of the key in this parent.
+        for(i = first ? i + 1 : i; i <= internal_node->num_keys && count < max; i++){
+            offsets[count++] = INTERNAL_OFFSET(internal_node, i);
+        }
+        buf_unpin((Page*)page, 0);
+
+        // Case : rightmost parent.
+        if(!has_fence){
+            break;
+        }
+        key = fence;
+        first = 0;
     }
 
-    if(buf_mgr == NULL){
-        /* Fail */
+    return count;
+}
+// Predict the leaves after leaf and prefetch those not issued yet.
+static void readahead_fill(ReadAhead *ra, LeafPage *leaf, int issued){
+    off_t targets[READAHEAD_MAX];
+    int i, num_targets = 0;
+
+    ra->count = readahead_collect(ra->table_id, LEAF_KEY(leaf, leaf->num_keys - 1), ra->offsets, ra->window);
+    // The scan is moving to the first predicted leaf right now.
+    ra->next = 1;
+
+    for(i = issued; i < ra->count; i++){
+        if(page_table_lookup(ra->table_id, ra->offsets[i]) == -1){
+            targets[num_targets++] = ra->offsets[i];
+        }
+    }
+
+    // Predicted leaves are already in the pool : read-ahead is not paying off.
+    if(num_targets == 0 && ra->count > issued){
+        ra->window = ra->window / 2 < READAHEAD_MIN ? READAHEAD_MIN : ra->window / 2;
+        if(ra->window > ra->limit){
+            ra->window = ra->limit;
+        }
+        return;
+    }
+
+    // Direct I/O : no page cache to hint, read the pages with one batch.
+    if(direct_io){
+        buf_ring_prefetch(ra->ring, ra->table_id, targets, num_targets);
+    }
+    else{
+        prefetch_pages(ra->table_id, targets, num_targets);
+    }
+}
+void readahead_leaf(ReadAhead *ra, LeafPage *leaf){
+    int remaining;
+
+    // Case : end of the sibling chain, or ring too small to read ahead.
+    if(leaf->sibling == 0 || leaf->num_keys == 0 || ra->limit == 0){
+        return;
+    }
+
+    // Case : prediction hit. Refill when half of the window is consumed.
+    if(ra->next < ra->count && ra->offsets[ra->next] == leaf->sibling){
+        remaining = ra->count - ra->next;
+        ra->next++;
+        if(remaining <= ra->window / 2){
+            if(ra->window * 2 <= ra->limit){
+                ra->window *= 2;
+            }
+            readahead_fill(ra, leaf, remaining);
+        }
+        return;
+    }
+
+    // Case : first leaf or misprediction. Start again with the smallest window.
+    if(ra->count > 0){
+        ra->window = ra->limit < READAHEAD_MIN ? ra->limit : READAHEAD_MIN;
+    }
+    // Sibling is read right after : do not prefetch it.
+    readahead_fill(ra, leaf, 1);
+}
+int replace_page(FILE *file){
+    int target_index;
+
+    // Case : free frame exists.
+    if(num_free_frames > 0){
+        return free_frames[--num_free_frames];
+    }
+
+    // Case : ask the replacement policy.
+    target_index = buf_policy->victim(file);
+
+    // Frames pinned by the background writer come back after its batch.
+    while(target_index == -1 && bg_in_flight){
+        wait_bg_writer();
+        if(num_free_frames > 0){
+            return free_frames[--num_free_frames];
+        }
+        target_index = buf_policy->victim(file);
+    }
+    if(target_index == -1){
+        // Busy buffer pool : every frame is pinned
         return -1;
     }
 
-    /* Success */
-    // Memory allocation
-    buf_size = num_buf;
+    // Output buffer : JOIN
+    if(buf_mgr[target_index].table_id == -1){
+        write_output_rows(file, (OutputPage *)buf_mgr[target_index].frame);
 
-    /* Recovery procedure */
-    log = open("log.db", O_RDWR);
+        buf_mgr[target_index].is_dirty = 0;
+    }
+    // Regular buffer
+    STATS_ADD(buf_mgr[target_index].table_id, evictions, 1);
+    // Check dirty bit.
+    if(buf_mgr[target_index].is_dirty == 1){
+        int page_lsn;
 
-    // Case 1 : Log file doesn't exist. Keep going
+        STATS_ADD(buf_mgr[target_index].table_id, dirty_evictions, 1);
 
-    // Case 2 : Log file exists. Do recovery.
-    if(log > 0){
-        recovery();
+        // Background writer fell behind : wake it up.
+        if(bg_running){
+            pthread_cond_signal(&bg_wake);
+        }
+        // Before flush page, excute WAL protocol
+        /* Current program only treats update for recovery which means treating modification of Leaf page */
+
+        /* Exclude HeaderPage & InternalPage*/
+        if(exclude_header(target_index)){
+            page_lsn = exclude_internal(target_index);
+            // Only for update query
+            if(page_lsn > 0){
+                execute_wal(page_lsn);
+            }
+        }
 
-        // Remove log file. & Reinitialize
-        close(log);
-        remove("log.db");
-        log = -1;
+        /* Flush page. */
+        flush_page(buf_mgr[target_index].table_id, buf_mgr[target_index].frame);
     }
 
-    return 0;
+    // Reinitialize : Evict
+    page_table_remove(target_index);
+    buf_policy->remove(target_index, 1);
+    reset_frame(target_index);
+
+    return target_index;
 }
 
-int close_table(int table_id){
-    int i;
+/* Flush function */
+void flush_page_to_buffer(int table_id, Page *page){
+    int i, buf_index = -1, index = -1;
 
-    // Failure case
-    if(table_id < 1 || table_id > 10 || buf_size == -1 || buf_mgr == NULL){
-        return -1;
+    // Page is a pinned frame modified in place : nothing to copy.
+    index = buf_frame_index(page);
+    if(index != -1){
+        buf_mgr[index].is_dirty = 1;
+        return;
+    }
+
+    // Check if target page is in buffer
+    // Decrease pin count : Done in is_in_buffer function.
+    // Dirty bit setting : Done in is_in_buffer function.
+    index = check_buffer_for_flush(table_id, page->file_offset);
+
+    // Page is in buffer
+    if(index != -1){
+        memcpy(buf_mgr[index].frame, page, sizeof(Page));
+        buf_mgr[index].is_dirty = 1;
+    }
+    // Page is not in buffer
+    else{
+        // Ref bit is already turned on in is_in_buffer.
+        buf_index = replace_page(NULL);
+
+        // Busy buffer pool : write through, keeping WAL order for leaf pages.
+        if(buf_index == -1){
+            if(page->file_offset != 0 && ((NodePage*)page)->is_leaf == 1 && ((NodePage*)page)->page_lsn > 0){
+                execute_wal(((NodePage*)page)->page_lsn);
+            }
+            flush_page(table_id, page);
+            return;
+        }
+        // Setting new buffer // 
+        // Page pointer is set already in replace_page function.
+        // Memory allocation & Memory copy
+        memcpy(buf_mgr[buf_index].frame, page, sizeof(Page));
+        // Setting dirty bit
+        install_frame(buf_index, table_id, page->file_offset, 1);
+    }
+}
+
+/* Background writer */
+void engine_lock(void){
+    if(engine_depth++ == 0){
+        pthread_mutex_lock(&engine_latch);
+        engine_ops++;
+    }
+}
+void engine_unlock(void){
+    // Statistics changed by the call reach the header frame once.
+    if(engine_depth == 1){
+        stats_flush_all();
+    }
+    if(--engine_depth == 0){
+        pthread_mutex_unlock(&engine_latch);
+    }
+}
+// Release the engine latch while waiting on cond, whatever the depth.
+static void engine_wait(pthread_cond_t *cond, const struct timespec *deadline){
+    int depth = engine_depth;
+
+    engine_depth = 0;
+    if(deadline == NULL){
+        pthread_cond_wait(cond, &engine_latch);
+    }
+    else{
+        pthread_cond_timedwait(cond, &engine_latch, deadline);
+    }
+    engine_depth = depth;
+}
+// Wait until the batch being written by the background writer is done.
+void wait_bg_writer(void){
+    while(bg_in_flight){
+        engine_wait(&bg_idle, NULL);
     }
+}
+// Write back dirty frames found ahead of the clock hand.
+// Called with the engine latch held. The latch is released during I/O.
+static int bg_write_batch(void){
+    int i, buf_index, num_dirty = 0, target, count = 0, page_lsn, max_lsn = 0;
 
     for(i = 0; i < buf_size; i++){
-        if(buf_mgr[i].table_id == table_id){
-            // If dirty bit is on, write page.
-            if(buf_mgr[i].is_dirty == 1){
-                flush_page(table_id, buf_mgr[i].frame);
+        if(buf_mgr[i].is_dirty == 1){
+            num_dirty++;
+        }
+    }
+
+    // Number of dirty frames over the clean target.
+    target = num_dirty - buf_size * (100 - bg_clean_percent) / 100;
+    if(target <= 0){
+        return 0;
+    }
+    if(target > bg_batch_size){
+        target = bg_batch_size;
+    }
+
+    // Frames right after the clock hand are the next victims.
+    for(i = 0; i < buf_size && count < target; i++){
+        buf_index = (clock_hand + i) % buf_size;
+
+        // Skip output pages of join, frames of scan rings and frames in use.
+        if(buf_mgr[buf_index].is_dirty != 1 || buf_mgr[buf_index].table_id < 1 ||
+                buf_mgr[buf_index].ring_id != 0 || buf_mgr[buf_index].pin_count > 0){
+            continue;
+        }
+
+        if(exclude_header(buf_index)){
+            page_lsn = exclude_internal(buf_index);
+            if(page_lsn > max_lsn){
+                max_lsn = page_lsn;
             }
-            // Reinitialize : Evict
-            memset(buf_mgr[i].frame, 0, sizeof(Page));
-            buf_mgr[i].table_id = 0;
-            buf_mgr[i].page_offset = 0;
-            buf_mgr[i].is_dirty = 0;
-            buf_mgr[i].refbit = 0;
         }
+
+        // Pinned until written : the page can't be evicted and read back stale.
+        memcpy(bg_pages + count, buf_mgr[buf_index].frame, sizeof(Page));
+        bg_ios[count].table_id = buf_mgr[buf_index].table_id;
+        bg_ios[count].page = bg_pages + count;
+        bg_frames[count] = buf_index;
+        buf_mgr[buf_index].pin_count++;
+        buf_mgr[buf_index].is_dirty = 0;
+        count++;
+    }
+    if(count == 0){
+        return 0;
+    }
+
+    // WAL : log records of the batch reach the log file before the pages.
+    if(max_lsn > 0){
+        execute_wal(max_lsn);
+    }
+
+    bg_in_flight = 1;
+    engine_unlock();
+
+    flush_pages(bg_ios, count);
+
+    engine_lock();
+    for(i = 0; i < count; i++){
+        buf_mgr[bg_frames[i]].pin_count--;
+    }
+    bg_in_flight = 0;
+    pthread_cond_broadcast(&bg_idle);
+
+    return count;
+}
+static void* bg_writer_main(void *arg){
+    struct timespec deadline;
+
+    (void)arg;
+
+    engine_lock();
+    while(bg_running){
+        // Full batch : the pool is still over the target, keep writing.
+        if(bg_write_batch() == bg_batch_size){
+            continue;
+        }
+
+        if(warm_file != NULL && time(NULL) - last_warm_dump >= WARM_DUMP_INTERVAL){
+            dump_buffer_pool();
+        }
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += BG_WRITER_INTERVAL * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        engine_wait(&bg_wake, &deadline);
     }
-    
-    // Close file
-    close_db(table_id);
+    engine_unlock();
+    page_io_destroy();
 
-    // Reinitialize dbfile
-    dbfile[table_id - 1] = 0;
+    return NULL;
+}
+int start_bg_writer(int clean_percent, int batch){
+    engine_lock();
+
+    // Failure case
+    if(bg_running || buf_mgr == NULL || clean_percent < 0 || clean_percent > 100 || batch < 1){
+        engine_unlock();
+        return -1;
+    }
+
+    bg_clean_percent = clean_percent;
+    bg_batch_size = batch < BG_WRITER_MAX_BATCH ? batch : BG_WRITER_MAX_BATCH;
+    bg_running = 1;
+    if(pthread_create(&bg_writer, NULL, bg_writer_main, NULL) != 0){
+        bg_running = 0;
+        engine_unlock();
+        return -1;
+    }
 
+    engine_unlock();
     return 0;
 }
+int stop_bg_writer(){
+    engine_lock();
+    if(!bg_running){
+        engine_unlock();
+        return -1;
+    }
+    bg_running = 0;
+    pthread_cond_signal(&bg_wake);
+    engine_unlock();
 
-int shutdown_db(){
-    int i,table_id = -1;
+    pthread_join(bg_writer, NULL);
+
+    return 0;
+}
 
+/* Merge policy */
+int set_merge_policy(int policy, int percent){
     // Failure case
-    if(buf_size == -1 || buf_mgr == NULL){
+    if(policy < MERGE_POLICY_EAGER || policy > MERGE_POLICY_EMPTY ||
+            (policy == MERGE_POLICY_THRESHOLD && (percent < 1 || percent > 50))){
         return -1;
     }
 
-    for(i = 0; i < buf_size; i++){
-        // If dirty bit is on, write page.
-        if(buf_mgr[i].is_dirty == 1){
-            table_id = buf_mgr[i].table_id;
-            flush_page(table_id, buf_mgr[i].frame);
+    engine_lock();
+    merge_policy = policy;
+    merge_percent = policy == MERGE_POLICY_THRESHOLD ? percent : 50;
+    engine_unlock();
+    return 0;
+}
+
+/* Background rebalancer */
+// Remember a leaf kept underfull by the merge policy.
+// Nothing to do under the eager policy : delete already merged it.
+static void rebalance_queue_push(int table_id, uint64_t key, off_t leaf_offset){
+    RebalanceEntry *last;
+
+    if(merge_policy == MERGE_POLICY_EAGER){
+        return;
+    }
+    if(rb_count == REBALANCE_QUEUE_SIZE){
+        if(!rb_sweep[table_id - 1]){
+            rb_sweep[table_id - 1] = 1;
+            rb_sweep_key[table_id - 1] = 0;
         }
-        // If buffer is used, memory free should be done.
-        if(1 <= buf_mgr[i].table_id && buf_mgr[i].table_id <= 10){
-            free(buf_mgr[i].frame);
+        return;
+    }
+
+    // Deletes in a row often hit the same leaf.
+    if(rb_count > 0 && leaf_offset != 0){
+        last = rb_queue + (rb_head + rb_count - 1) % REBALANCE_QUEUE_SIZE;
+        if(last->table_id == table_id && last->leaf_offset == leaf_offset){
+            return;
         }
     }
 
-    // Destroy allocated buffer
-    free(buf_mgr);
+    last = rb_queue + (rb_head + rb_count) % REBALANCE_QUEUE_SIZE;
+    last->table_id = table_id;
+    last->key = key;
+    last->leaf_offset = leaf_offset;
+    rb_count++;
+}
+// Compact the leaf of the sweep if underfull, then move the sweep to the next leaf.
+static void bg_rebalance_sweep(int table_id){
+    LeafPage* leaf_node;
+    uint64_t key = rb_sweep_key[table_id - 1];
+    off_t sibling;
+
+    leaf_node = find_leaf_path(table_id, key, NULL);
+    if(leaf_node != NULL && leaf_node->file_offset != dbheader[table_id - 1].root_offset &&
+            leaf_node->num_keys < merge_min_keys((NodePage*)leaf_node, 1)){
+        buf_unpin((Page*)leaf_node, 0);
+        rebalance_path(table_id, key, 1);
+        leaf_node = find_leaf_path(table_id, key, NULL);
+    }
+    if(leaf_node == NULL){
+        rb_sweep[table_id - 1] = 0;
+        return;
+    }
+
+    sibling = leaf_node->sibling;
+    buf_unpin((Page*)leaf_node, 0);
+    if(sibling == 0){
+        rb_sweep[table_id - 1] = 0;
+        return;
+    }
+    leaf_node = (LeafPage*)buf_pin(table_id, sibling);
+    if(leaf_node == NULL){
+        return;
+    }
+    rb_sweep_key[table_id - 1] = LEAF_KEY(leaf_node, 0);
+    buf_unpin((Page*)leaf_node, 0);
+}
+// Compact up to a batch of queued leaves, back to half full.
+// Called with the engine latch held.
+static int bg_rebalance_batch(void){
+    RebalanceEntry entry;
+    int i, count = 0;
+
+    while(rb_count > 0 && count < rb_batch_size){
+        entry = rb_queue[rb_head];
+        rb_head = (rb_head + 1) % REBALANCE_QUEUE_SIZE;
+        rb_count--;
+
+        // Table closed since
+        if(dbfile[entry.table_id - 1] <= 0){
+            continue;
+        }
+        // The leaf is found again by its key : it may have been split or merged since.
+        rebalance_path(entry.table_id, entry.key, 1);
+        count++;
+    }
+
+    for(i = 0; i < 10; i++){
+        while(rb_sweep[i] && count < rb_batch_size){
+            if(dbfile[i] <= 0){
+                rb_sweep[i] = 0;
+                break;
+            }
+            bg_rebalance_sweep(i + 1);
+            count++;
+        }
+    }
+    return count;
+}
+static void* bg_rebalancer_main(void *arg){
+    struct timespec deadline;
+    uint64_t ops;
+
+    (void)arg;
+
+    engine_lock();
+    while(rb_running){
+        // Idle : no call took the latch during the last interval, and no cursor is open.
+        ops = engine_ops;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += BG_REBALANCER_INTERVAL * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        engine_wait(&rb_wake, &deadline);
+
+        if(rb_running && ops == engine_ops && open_cursors == 0 && buf_mgr != NULL){
+            bg_rebalance_batch();
+        }
+    }
+    engine_unlock();
+
+    return NULL;
+}
+int start_bg_rebalancer(int batch){
+    engine_lock();
+
+    // Failure case
+    if(rb_running || buf_mgr == NULL || batch < 1){
+        engine_unlock();
+        return -1;
+    }
+
+    rb_batch_size = batch;
+    rb_running = 1;
+    if(pthread_create(&bg_rebalancer, NULL, bg_rebalancer_main, NULL) != 0){
+        rb_running = 0;
+        engine_unlock();
+        return -1;
+    }
 
+    engine_unlock();
     return 0;
 }
-// Load function
-void load_page_from_buffer(int table_id, off_t offset, Page* page){
-    Page *temp;
-    int buf_index = -1;
+int stop_bg_rebalancer(){
+    engine_lock();
+    if(!rb_running){
+        engine_unlock();
+        return -1;
+    }
+    rb_running = 0;
+    pthread_cond_signal(&rb_wake);
+    engine_unlock();
 
-    temp = check_buffer_for_load(table_id, offset);
+    pthread_join(bg_rebalancer, NULL);
 
-    // Page is in buffer pool.
-    if(temp != NULL){
-        // Load page from buffer pool.
-        memcpy(page, temp, sizeof(Page));
-        page->file_offset = offset;
+    return 0;
+}
 
-        /* Turn ref bit on */
-        // Previously done in is_in_buffer function
+/* Warm start */
+static int compare_warm_entry(const void *a, const void *b){
+    const WarmEntry *x = (const WarmEntry*)a, *y = (const WarmEntry*)b;
+
+    if(x->dev != y->dev){
+        return (x->dev > y->dev) - (x->dev < y->dev);
     }
-    // Page is not in buffer pool.
-    else{
-        buf_index = replace_page(NULL);
+    if(x->ino != y->ino){
+        return (x->ino > y->ino) - (x->ino < y->ino);
+    }
+    return (x->page_offset > y->page_offset) - (x->page_offset < y->page_offset);
+}
+// Device and inode of the data file of an open table.
+static int warm_file_id(int table_id, uint64_t *dev, uint64_t *ino){
+    struct stat st;
 
-        // Load from disk.
-        load_page(table_id, offset, page);
-        page->file_offset = offset; 
+    if(dbfile[table_id - 1] <= 0 || fstat(dbfile[table_id - 1], &st) != 0){
+        return -1;
+    }
+    *dev = st.st_dev;
+    *ino = st.st_ino;
 
-        /* Not busy buffer pool */
-        // In case of busy buffer pool, just load page from disk.
-        /* Setting new buffer */ 
-        // Page index is set already in replace_page function.
-        // Memory allocation & Memory copy
-        memcpy(buf_mgr[buf_index].frame, page, sizeof(Page));
-        buf_mgr[buf_index].table_id = table_id;
-        buf_mgr[buf_index].page_offset = offset;
-        buf_mgr[buf_index].is_dirty = 0;
-        buf_mgr[buf_index].refbit = 1;
+    return 0;
+}
+int set_warm_file(const char *pathname){
+    char *copy = NULL;
+
+    engine_lock();
+    if(pathname != NULL){
+        copy = strdup(pathname);
+        if(copy == NULL){
+            engine_unlock();
+            return -1;
+        }
+    }
+    free(warm_file);
+    warm_file = copy;
+
+    // Engine is running : tables opened from now on are warmed from this list.
+    if(buf_mgr != NULL){
+        load_warm_list();
     }
+
+    engine_unlock();
+    return 0;
 }
-Page* check_buffer_for_load(int table_id, off_t offset){
-    int i;
+int dump_buffer_pool(){
+    WarmHeader header;
+    WarmEntry *entries;
+    uint64_t dev[10], ino[10];
+    int i, buf_index, fd, count = 0, has_id[10];
+    char *temp_file;
+    ssize_t len;
+
+    engine_lock();
+    if(buf_mgr == NULL || warm_file == NULL){
+        engine_unlock();
+        return -1;
+    }
 
-    if(buf_size == -1){
-        // Error case 
-        return NULL;
+    entries = (WarmEntry *)malloc(buf_size * sizeof(WarmEntry));
+    temp_file = (char *)malloc(strlen(warm_file) + 5);
+    if(entries == NULL || temp_file == NULL){
+        free(entries);
+        free(temp_file);
+        engine_unlock();
+        return -1;
     }
+    sprintf(temp_file, "%s.tmp", warm_file);
 
-    for(i = 0; i < buf_size; i++){
-        if(buf_mgr[target_buf].table_id == table_id && buf_mgr[target_buf].page_offset == offset){
+    for(i = 0; i < 10; i++){
+        has_id[i] = warm_file_id(i + 1, &dev[i], &ino[i]) == 0;
+    }
 
-            buf_mgr[target_buf].refbit = 1;
+    // Frames in clock order from the hand : coldest pages first.
+    for(i = 0; i < buf_size; i++){
+        buf_index = (clock_hand + i) % buf_size;
 
-            return buf_mgr[target_buf].frame;
+        // Skip free frames, output pages of join and frames of scan rings.
+        if(buf_mgr[buf_index].table_id < 1 || buf_mgr[buf_index].ring_id != 0 ||
+                !has_id[buf_mgr[buf_index].table_id - 1]){
+            continue;
         }
-        target_buf = (target_buf + 1) % buf_size;
+        entries[count].dev = dev[buf_mgr[buf_index].table_id - 1];
+        entries[count].ino = ino[buf_mgr[buf_index].table_id - 1];
+        entries[count].refbit = buf_mgr[buf_index].refbit;
+        entries[count].page_offset = buf_mgr[buf_index].page_offset;
+        count++;
     }
+    last_warm_dump = time(NULL);
 
-    // Unmatched case
-    return NULL;
-}
-int check_buffer_for_flush(int table_id, off_t offset){
-    int i;
+    header.magic = WARM_MAGIC;
+    header.count = count;
 
-    if(buf_size == -1){
-        // Error case 
+    // Write a new file then rename : a crash never leaves a half written list.
+    fd = open(temp_file, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+    if(fd < 0){
+        free(entries);
+        free(temp_file);
+        engine_unlock();
         return -1;
     }
+    len = write(fd, &header, sizeof(header));
+    if(len == sizeof(header) && count > 0){
+        len = write(fd, entries, count * sizeof(WarmEntry)) == (ssize_t)(count * sizeof(WarmEntry)) ? len : -1;
+    }
+    close(fd);
+    free(entries);
 
-    for(i = 0; i < buf_size; i++){
-        if(buf_mgr[target_buf].table_id == table_id && buf_mgr[target_buf].page_offset == offset){
-
-            buf_mgr[target_buf].refbit = 1;
-
-            return target_buf;
-        }
-        target_buf = (target_buf + 1) % buf_size;
+    if(len != sizeof(header) || rename(temp_file, warm_file) != 0){
+        unlink(temp_file);
+        free(temp_file);
+        engine_unlock();
+        return -1;
     }
 
-    // Unmatched case
-    return -1;
+    free(temp_file);
+    engine_unlock();
+    return 0;
 }
+// Read the list of pages written by the last dump.
+static void load_warm_list(void){
+    WarmHeader header;
+    int fd;
 
-int replace_page(FILE *file){
-    /* Used variable : clock_hand, buf_size */
-    int target_index = -1;
-
-    // Spin only one cycle.
-    while(target_index == -1){
-        /* Check refernce bit */
-        // Case : reference bit is off.
-        if(buf_mgr[clock_hand].refbit == 0){
-            // Setting target_index
-            target_index = clock_hand;
-
-            // Output buffer : JOIN
-            if(buf_mgr[clock_hand].table_id == -1){
-                int i;
-                OutputPage *target;
-
-                memcpy((Page *)target, buf_mgr[clock_hand].frame, sizeof(Page));
-
-                for(int i = 0; i < target->file_offset; i++){
-                    fprintf(file, "%" PRIu64 ",%s," "%" PRIu64 ",%s\n", RESULT_KEY1(target, i), RESULT_VALUE1(target, i), RESULT_KEY2(target, i), RESULT_VALUE2(target, i) );
-                }
-
-                buf_mgr[clock_hand].is_dirty = 0;
-            }
-            // Regular buffer
-            // Check dirty bit.
-            if(buf_mgr[clock_hand].is_dirty == 1){
-                int page_lsn;
-                // Before flush page, excute WAL protocol
-                /* Current program only treats update for recovery which means treating modification of Leaf page */
-
-                /* Exclude HeaderPage & InternalPage*/
-                if(exclude_header()){
-                    page_lsn = exclude_internal();
-                    // Only for update query
-                    if(page_lsn > 0){
-                        execute_wal(page_lsn);
-                    }
-                }
+    free(warm_pages);
+    warm_pages = NULL;
+    num_warm_pages = 0;
 
-                /* Flush page. */
-                flush_page(buf_mgr[clock_hand].table_id, buf_mgr[clock_hand].frame);
-            }
+    if(warm_file == NULL){
+        return;
+    }
+    fd = open(warm_file, O_RDONLY);
+    if(fd < 0){
+        return;
+    }
 
-            // Reinitialize : Evict
-            memset(buf_mgr[clock_hand].frame, 0, sizeof(Page));
-            buf_mgr[clock_hand].table_id = 0;
-            buf_mgr[clock_hand].page_offset = 0;
-            buf_mgr[clock_hand].is_dirty = 0;
-            buf_mgr[clock_hand].refbit = 0;
+    if(read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == WARM_MAGIC && header.count > 0){
+        warm_pages = (WarmEntry *)malloc(header.count * sizeof(WarmEntry));
+        if(warm_pages != NULL &&
+                read(fd, warm_pages, header.count * sizeof(WarmEntry)) == (ssize_t)(header.count * sizeof(WarmEntry))){
+            num_warm_pages = header.count;
+            // Sorted by file position : each table gets one sorted batch of reads.
+            qsort(warm_pages, num_warm_pages, sizeof(WarmEntry), compare_warm_entry);
         }
-
-        // Case : reference bit is on.
-        // Turn off the reference bit.
         else{
-            if(buf_mgr[clock_hand].refbit == 1){
-                buf_mgr[clock_hand].refbit = 0;
-            }
-
-            // Move clock hand
-            clock_hand = (clock_hand + 1) % buf_size;
+            free(warm_pages);
+            warm_pages = NULL;
         }
     }
-
-    return target_index;
+    close(fd);
 }
+// Preload pages of the table from the warm list into free frames.
+// Warm-up never evicts : it stops when no free frame is left.
+static void warm_table(int table_id){
+    struct timespec start, end;
+    PageIO *ios;
+    int *refbits;
+    int i, count = 0, buf_index;
+    uint64_t dev, ino;
+    off_t file_size;
+
+    if(num_warm_pages == 0 || num_free_frames == 0 || warm_file_id(table_id, &dev, &ino) != 0){
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-/* Flush function */
-void flush_page_to_buffer(int table_id, Page *page){
-    int i, buf_index = -1, index = -1;
+    ios = (PageIO *)malloc(num_free_frames * sizeof(PageIO));
+    refbits = (int *)malloc(num_free_frames * sizeof(int));
+    if(ios == NULL || refbits == NULL){
+        free(ios);
+        free(refbits);
+        return;
+    }
 
-    // Check if target page is in buffer
-    // Decrease pin count : Done in is_in_buffer function.
-    // Dirty bit setting : Done in is_in_buffer function.
-    index = check_buffer_for_flush(table_id, page->file_offset);
+    file_size = dbheader[table_id - 1].num_pages * PAGE_SIZE;
+    for(i = 0; i < num_warm_pages && num_free_frames > 0; i++){
+        if(warm_pages[i].dev != dev || warm_pages[i].ino != ino){
+            continue;
+        }
+        // Used once : the table may be closed and opened again.
+        warm_pages[i].dev = 0;
+        warm_pages[i].ino = 0;
+        if(warm_pages[i].page_offset >= file_size ||
+                page_table_lookup(table_id, warm_pages[i].page_offset) != -1){
+            continue;
+        }
 
-    // Page is in buffer
-    if(index != -1){
-        memcpy(buf_mgr[target_buf].frame, page, sizeof(Page));
-        buf_mgr[target_buf].is_dirty = 1;
+        buf_index = free_frames[--num_free_frames];
+        ios[count].table_id = table_id;
+        ios[count].offset = warm_pages[i].page_offset;
+        ios[count].page = buf_mgr[buf_index].frame;
+        refbits[count] = warm_pages[i].refbit;
+        count++;
     }
-    // Page is not in buffer
-    else{
-        // Ref bit is already turned on in is_in_buffer.
-        buf_index = replace_page(NULL);
-        // Setting new buffer // 
-        // Page pointer is set already in replace_page function.
-        // Memory allocation & Memory copy
-        memcpy(buf_mgr[buf_index].frame, page, sizeof(Page));
-        buf_mgr[buf_index].table_id = table_id;
-        buf_mgr[buf_index].page_offset = page->file_offset;
-        // Setting dirty bit
-        buf_mgr[buf_index].is_dirty = 1;
-        buf_mgr[buf_index].refbit = 1;
+
+    load_pages(ios, count);
+
+    for(i = 0; i < count; i++){
+        buf_index = buf_frame_index(ios[i].page);
+        install_frame(buf_index, table_id, ios[i].offset, 0);
+        buf_mgr[buf_index].refbit = refbits[i];
     }
+
+    free(ios);
+    free(refbits);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    warm_time_us += (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+    warm_loaded_pages += count;
 }
 
 /* Project Join */
@@ -1602,13 +4480,24 @@ void flush_page_to_buffer(int table_id, Page *page){
 int join_table(int table_id_1, int table_id_2, char *pathname){
     FILE *r_fp;
     uint64_t num_1 = -1, num_2 = -1, min_1 = -1, min_2 = -1, max_1 = -1, max_2 = -1;
-    LeafPage leaf_1, leaf_2;
+    LeafPage *leaf_1, *leaf_2;
     off_t comp_sib_1, comp_sib_2;
     int comp_num_1, comp_num_2;
     uint64_t comp_key_1, comp_key_2;
+    BufferRing ring_1, ring_2;
+    ReadAhead ra_1, ra_2;
+
+    engine_lock();
+
+    /* Join pins both current leaves and keeps the output page */
+    if(buf_size < 3){
+        engine_unlock();
+        return -1;
+    }
 
     /* Open file where result table will be written */
     if((r_fp = fopen(pathname, "wt")) == NULL){
+        engine_unlock();
         return -1;
     }
 
@@ -1620,38 +4509,63 @@ int join_table(int table_id_1, int table_id_2, char *pathname){
 
     /* 
         Exception check : if no common key, just return.
-        Checking via min - max range.
+        Checking via min - max range. Bounds of an empty table are 0.
     */
-    if(max_1 < min_2 || min_1 > max_2){
+    if(num_1 == 0 || num_2 == 0 || max_1 < min_2 || min_1 > max_2){
         // Close file pointer
         fclose(r_fp);
 
+        engine_unlock();
         return 0;
     }
 
+    /* Leaves are scanned through private rings : hot pages stay in the pool.
+       Next leaves are prefetched while scanning. */
+    buf_ring_init(&ring_1);
+    buf_ring_init(&ring_2);
+    readahead_init(&ra_1, table_id_1, &ring_1);
+    readahead_init(&ra_2, table_id_2, &ring_2);
+
     /* 
         Start condition : load initial leaf page of each table.
-        -> Use find_leaf function 
+        -> Use find_leaf_pinned function : leaves are read in place 
     */
 
     // Case : Cut off table 1
     if(min_1 < min_2){
         // Table 1 : cut off
         // Table 2 : just load first leaf page
-        find_leaf(table_id_1, min_2, &leaf_1);
-        find_leaf(table_id_2, min_2, &leaf_2);
+        leaf_1 = find_leaf_pinned(table_id_1, min_2);
+        leaf_2 = find_leaf_pinned(table_id_2, min_2);
     }
     // Case : Cut off table 2
     else{
         // Table 1 : just load fisrt leaf page
         // Table 2 : cut off
-        find_leaf(table_id_1, min_1, &leaf_1);
-        find_leaf(table_id_2, min_1, &leaf_2);
+        leaf_1 = find_leaf_pinned(table_id_1, min_1);
+        leaf_2 = find_leaf_pinned(table_id_2, min_1);
+    }
+
+    // Failure case : a tree without leaves, or a leaf not loaded.
+    if(leaf_1 == NULL || leaf_2 == NULL){
+        if(leaf_1 != NULL){
+            buf_unpin((Page*)leaf_1, 0);
+        }
+        if(leaf_2 != NULL){
+            buf_unpin((Page*)leaf_2, 0);
+        }
+        buf_ring_free(&ring_1);
+        buf_ring_free(&ring_2);
+
+        fclose(r_fp);
+
+        engine_unlock();
+        return 0;
     }
 
     // Initial condition
-    comp_sib_1 = leaf_1.sibling;
-    comp_sib_2 = leaf_2.sibling;
+    comp_sib_1 = leaf_1->sibling;
+    comp_sib_2 = leaf_2->sibling;
     comp_num_1 = 0;
     comp_num_2 = 0;
 
@@ -1660,10 +4574,10 @@ int join_table(int table_id_1, int table_id_2, char *pathname){
         -> Until rightmost sibling & last key ( Checking via number of keys)
     */
 
-    while((comp_sib_1 != 0 || comp_num_1 != leaf_1.num_keys) && (comp_sib_2 != 0 || comp_num_2 != leaf_2.num_keys)){
+    while((comp_sib_1 != 0 || comp_num_1 != leaf_1->num_keys) && (comp_sib_2 != 0 || comp_num_2 != leaf_2->num_keys)){
         /* Compare & produce result */
-        comp_key_1 = LEAF_KEY(&leaf_1, comp_num_1);
-        comp_key_2 = LEAF_KEY(&leaf_2, comp_num_2);
+        comp_key_1 = LEAF_KEY(leaf_1, comp_num_1);
+        comp_key_2 = LEAF_KEY(leaf_2, comp_num_2);
         
         // Compare
         while(comp_key_1 < comp_key_2){
@@ -1671,58 +4585,72 @@ int join_table(int table_id_1, int table_id_2, char *pathname){
             comp_num_1++;
 
             // Case : Change table1's leaf page
-            if((comp_num_1 == leaf_1.num_keys) && (comp_sib_1 != 0)){
+            if((comp_num_1 == leaf_1->num_keys) && (comp_sib_1 != 0)){
                 // Update leaf page
-                load_page_from_buffer(table_id_1, comp_sib_1, (Page*)&leaf_1);
+                readahead_leaf(&ra_1, leaf_1);
+                buf_unpin((Page*)leaf_1, 0);
+                leaf_1 = (LeafPage*)buf_pin_ring(&ring_1, table_id_1, comp_sib_1);
 
                 // Update sibling offset
-                comp_sib_1 = leaf_1.sibling;
+                comp_sib_1 = leaf_1->sibling;
 
                 // Reinitialize
                 comp_num_1 = 0;
             }
 
             // Terminate comdition
-            if(comp_sib_1 == 0 && comp_num_1 ==  leaf_1.num_keys){
+            if(comp_sib_1 == 0 && comp_num_1 ==  leaf_1->num_keys){
+                buf_unpin((Page*)leaf_1, 0);
+                buf_unpin((Page*)leaf_2, 0);
+                buf_ring_free(&ring_1);
+                buf_ring_free(&ring_2);
                 sync_buffer(r_fp);
                 fclose(r_fp);
+                engine_unlock();
                 return 0;
             }
 
             // Update compare key
-            comp_key_1 = LEAF_KEY(&leaf_1, comp_num_1);
+            comp_key_1 = LEAF_KEY(leaf_1, comp_num_1);
         }
         while(comp_key_1 > comp_key_2){
             // Advance table 2
             comp_num_2++;
             
             // Case : Change table2's leaf page
-            if((comp_num_2 == leaf_2.num_keys) && (comp_sib_2 != 0)){
+            if((comp_num_2 == leaf_2->num_keys) && (comp_sib_2 != 0)){
                 // Update leaf page
-                load_page_from_buffer(table_id_2, comp_sib_2, (Page*)&leaf_2);
+                readahead_leaf(&ra_2, leaf_2);
+                buf_unpin((Page*)leaf_2, 0);
+                leaf_2 = (LeafPage*)buf_pin_ring(&ring_2, table_id_2, comp_sib_2);
 
                 // Update sibling offset
-                comp_sib_2 = leaf_2.sibling;
+                comp_sib_2 = leaf_2->sibling;
 
                 // Reinitialize
                 comp_num_2 = 0;
             }
 
             // Terminate condition
-            if(comp_sib_1 == 0 && comp_num_1 == leaf_1.num_keys){
+            if(comp_sib_2 == 0 && comp_num_2 == leaf_2->num_keys){
+                buf_unpin((Page*)leaf_1, 0);
+                buf_unpin((Page*)leaf_2, 0);
+                buf_ring_free(&ring_1);
+                buf_ring_free(&ring_2);
                 sync_buffer(r_fp);
                 fclose(r_fp);
+                engine_unlock();
                 return 0;
             }
 
             // Update compare key
-            comp_key_2 = LEAF_KEY(&leaf_2, comp_num_2);
+            comp_key_2 = LEAF_KEY(leaf_2, comp_num_2);
         }
 
         if(comp_key_1 == comp_key_2){
             /* Produce */
             // Notice that two tables are on unique key condition.
-            write_output_buffer(r_fp, comp_key_1, LEAF_VALUE(&leaf_1, comp_num_1), comp_key_2, LEAF_VALUE(&leaf_2, comp_num_2));
+            write_output_buffer(r_fp, comp_key_1, LEAF_VALUE(leaf_1, comp_num_1), comp_key_2, LEAF_VALUE(leaf_2, comp_num_2));
 
             /* Advance each key */
             // Update compare number
@@ -1730,24 +4658,28 @@ int join_table(int table_id_1, int table_id_2, char *pathname){
             comp_num_2++;
 
             // Case : Change table1's leaf page
-            if((comp_num_1 == leaf_1.num_keys) && (comp_sib_1 != 0)){
+            if((comp_num_1 == leaf_1->num_keys) && (comp_sib_1 != 0)){
                 // Update leaf page
-                load_page_from_buffer(table_id_1, comp_sib_1, (Page*)&leaf_1);
+                readahead_leaf(&ra_1, leaf_1);
+                buf_unpin((Page*)leaf_1, 0);
+                leaf_1 = (LeafPage*)buf_pin_ring(&ring_1, table_id_1, comp_sib_1);
 
                 // Update sibling offset
-                comp_sib_1 = leaf_1.sibling;
+                comp_sib_1 = leaf_1->sibling;
 
                 // Reinitialize
                 comp_num_1 = 0;
             }
 
             // Case : Change table2's leaf page
-            if((comp_num_2 == leaf_2.num_keys) && (comp_sib_2 != 0)){
+            if((comp_num_2 == leaf_2->num_keys) && (comp_sib_2 != 0)){
                 // Update leaf page
-                load_page_from_buffer(table_id_2, comp_sib_2, (Page*)&leaf_2);
+                readahead_leaf(&ra_2, leaf_2);
+                buf_unpin((Page*)leaf_2, 0);
+                leaf_2 = (LeafPage*)buf_pin_ring(&ring_2, table_id_2, comp_sib_2);
 
                 // Update sibling offset
-                comp_sib_2 = leaf_2.sibling;
+                comp_sib_2 = leaf_2->sibling;
 
                 // Reinitialize
                 comp_num_2 = 0;
@@ -1756,57 +4688,225 @@ int join_table(int table_id_1, int table_id_2, char *pathname){
             // Update compare key : Done in first part of loop
         }
     }
+    buf_unpin((Page*)leaf_1, 0);
+    buf_unpin((Page*)leaf_2, 0);
+    buf_ring_free(&ring_1);
+    buf_ring_free(&ring_2);
     sync_buffer(r_fp);
     fclose(r_fp);
+    engine_unlock();
     return 0;
 }
-void table_info(int table_id, uint64_t *num_keys, uint64_t *min_key, uint64_t *max_key){
-    HeaderPage temp_header;
-    NodePage page;
-    LeafPage *temp_leaf;
-    off_t temp_sibling;
+/* Table statistics */
+// Records added, with keys in [min_key, max_key].
+static void stats_add_keys(int table_id, uint64_t count, uint64_t min_key, uint64_t max_key){
+    TableStats *stats = &dbheader[table_id - 1].stats;
+
+    if(stats->num_keys == 0 || min_key < stats->min_key){
+        stats->min_key = min_key;
+    }
+    if(stats->num_keys == 0 || max_key > stats->max_key){
+        stats->max_key = max_key;
+    }
+    stats->num_keys += count;
+    stats_dirty[table_id - 1] = 1;
+}
+static void stats_remove_keys(int table_id, uint64_t count){
+    TableStats *stats = &dbheader[table_id - 1].stats;
+
+    stats->num_keys = stats->num_keys > count ? stats->num_keys - count : 0;
+    stats_dirty[table_id - 1] = 1;
+}
+// One record deleted : the bounds move if it was the smallest or the largest key.
+static void stats_remove_key(int table_id, uint64_t key){
+    stats_remove_keys(table_id, 1);
+    if(key == dbheader[table_id - 1].stats.min_key || key == dbheader[table_id - 1].stats.max_key){
+        stats_refresh_bounds(table_id);
+    }
+}
+// Pages taken (positive) or freed (negative), and levels added or removed.
+static void stats_add_pages(int table_id, int leaves, int internals, int height){
+    TableStats *stats = &dbheader[table_id - 1].stats;
+
+    stats->num_leaves += leaves;
+    stats->num_internals += internals;
+    stats->height += height;
+    stats_dirty[table_id - 1] = 1;
+}
+// Smallest and largest keys from the leftmost and rightmost leaves : two descents.
+static void stats_refresh_bounds(int table_id){
+    TableStats *stats = &dbheader[table_id - 1].stats;
+    NodePage *page;
+    off_t offset;
+    int rightmost;
+
+    stats_dirty[table_id - 1] = 1;
+
+    // Case : empty tree.
+    if(dbheader[table_id - 1].root_offset == 0){
+        memset(stats, 0, sizeof(TableStats));
+        dbheader[table_id - 1].stats_magic = TABLE_STATS_MAGIC;
+        return;
+    }
+
+    for(rightmost = 0; rightmost < 2; rightmost++){
+        offset = dbheader[table_id - 1].root_offset;
+        page = (NodePage*)buf_pin(table_id, offset);
+        while(page != NULL && !page->is_leaf){
+            offset = INTERNAL_OFFSET((InternalPage*)page, rightmost ? page->num_keys : 0);
+            buf_unpin((Page*)page, 0);
+            page = (NodePage*)buf_pin(table_id, offset);
+        }
+        // Every frame is pinned : count the table again when asked.
+        if(page == NULL){
+            dbheader[table_id - 1].stats_magic = 0;
+            return;
+        }
+        if(rightmost){
+            stats->max_key = LEAF_KEY((LeafPage*)page, page->num_keys - 1);
+        }
+        else{
+            stats->min_key = LEAF_KEY((LeafPage*)page, 0);
+        }
+        buf_unpin((Page*)page, 0);
+    }
+}
+// Copy changed statistics to the header frame. Called when the engine latch is released.
+static void stats_flush_all(void){
+    HeaderPage *header;
+    int i;
+
+    for(i = 0; i < 10; i++){
+        if(!stats_dirty[i]){
+            continue;
+        }
+        stats_dirty[i] = 0;
+        if(dbfile[i] <= 0 || buf_mgr == NULL){
+            continue;
+        }
+
+        header = (HeaderPage*)buf_pin(i + 1, 0);
+        if(header == NULL){
+            flush_page_to_buffer(i + 1, (Page*)(dbheader + i));
+            continue;
+        }
+        header->stats_magic = dbheader[i].stats_magic;
+        header->stats = dbheader[i].stats;
+        buf_unpin((Page*)header, 1);
+    }
+}
+// Internal nodes under offset, at level of a tree of height levels.
+static uint64_t stats_count_internals(int table_id, off_t offset, int level, int height){
+    InternalPage *node;
+    uint64_t count = 1;
+    int i;
 
-    // Load header page.
-    load_page_from_buffer(table_id, 0, (Page*)(&temp_header));
+    // Children are leaves : no need to read them.
+    if(level >= height - 2){
+        return 1;
+    }
 
-    /* Case : Empty table */
-    if(temp_header.root_offset == 0){
-        *num_keys = 0;
-        *max_key = 0;
+    node = (InternalPage*)buf_pin(table_id, offset);
+    if(node == NULL){
+        return 1;
+    }
+    for(i = 0; i <= node->num_keys; i++){
+        count += stats_count_internals(table_id, INTERNAL_OFFSET(node, i), level + 1, height);
+    }
+    buf_unpin((Page*)node, 0);
+    return count;
+}
+// Count the tree : files written before the statistics, or after a range delete
+// dropped leaves it did not read. The leaves are read once, through a scan ring.
+static void stats_rebuild(int table_id){
+    TableStats *stats = &dbheader[table_id - 1].stats;
+    NodePage *page;
+    LeafPage *leaf;
+    off_t sibling;
+    BufferRing ring;
+    ReadAhead ra;
+
+    memset(stats, 0, sizeof(TableStats));
+    dbheader[table_id - 1].stats_magic = TABLE_STATS_MAGIC;
+    stats_dirty[table_id - 1] = 1;
+
+    if(dbheader[table_id - 1].root_offset == 0){
+        return;
+    }
 
+    // Leftmost leaf, and the height on the way.
+    page = (NodePage*)buf_pin(table_id, dbheader[table_id - 1].root_offset);
+    stats->height = 1;
+    while(page != NULL && !page->is_leaf){
+        sibling = INTERNAL_OFFSET((InternalPage*)page, 0);
+        buf_unpin((Page*)page, 0);
+        page = (NodePage*)buf_pin(table_id, sibling);
+        stats->height++;
+    }
+    if(page == NULL){
+        dbheader[table_id - 1].stats_magic = 0;
         return;
     }
-    
-    // Load root page.
-    load_page_from_buffer(table_id, temp_header.root_offset, (Page*)&page);
+    if(stats->height > 1){
+        stats->num_internals = stats_count_internals(table_id, dbheader[table_id - 1].root_offset, 0, stats->height);
+    }
 
-    // Search leaf page whcih has the smallest key.
-    while(!page.is_leaf){
-        InternalPage* internal_node = (InternalPage*)&page;
-        
-        load_page_from_buffer(table_id, INTERNAL_OFFSET(internal_node, 0), (Page*)&page);
-	}
+    /* Leaves are scanned through a private ring : hot pages stay in the pool */
+    buf_ring_init(&ring);
+    readahead_init(&ra, table_id, &ring);
+
+    leaf = (LeafPage*)page;
+    stats->min_key = LEAF_KEY(leaf, 0);
+    while(1){
+        stats->num_leaves++;
+        stats->num_keys += leaf->num_keys;
+        stats->max_key = LEAF_KEY(leaf, leaf->num_keys - 1);
+        sibling = leaf->sibling;
+        if(sibling == 0){
+            break;
+        }
 
-    /* Proceed until last leaf page using sibling.
-       Sum each leaf page's number of keys and find maximum key. */
+        readahead_leaf(&ra, leaf);
+        buf_unpin((Page*)leaf, 0);
+        leaf = (LeafPage*)buf_pin_ring(&ring, table_id, sibling);
+        if(leaf == NULL){
+            dbheader[table_id - 1].stats_magic = 0;
+            buf_ring_free(&ring);
+            return;
+        }
+    }
 
-    // First, set initial condition.
-    temp_leaf = (LeafPage *)&page;
+    buf_unpin((Page*)leaf, 0);
+    buf_ring_free(&ring);
+}
+int get_table_stats(int table_id, TableStats *stats){
+    engine_lock();
 
-    *num_keys = temp_leaf->num_keys;
-    *min_key = LEAF_KEY(temp_leaf, 0);
-    *max_key = LEAF_KEY(temp_leaf, temp_leaf->num_keys - 1);
-    temp_sibling = temp_leaf->sibling;
+    // Failure case
+    if(table_id < 1 || table_id > 10 || buf_size == -1 || buf_mgr == NULL || dbfile[table_id - 1] <= 0 ||
+            stats == NULL){
+        engine_unlock();
+        return -1;
+    }
 
-    while(temp_sibling != 0){
-        // Load sibling leaf page.
-        load_page_from_buffer(table_id, temp_sibling, (Page*)temp_leaf);
-        
-        *num_keys += temp_leaf->num_keys;
-        *max_key = LEAF_KEY(temp_leaf, temp_leaf->num_keys - 1);
-        temp_sibling = temp_leaf->sibling;
+    if(dbheader[table_id - 1].stats_magic != TABLE_STATS_MAGIC){
+        stats_rebuild(table_id);
     }
+    *stats = dbheader[table_id - 1].stats;
+
+    engine_unlock();
+    return 0;
+}
+// Number of records and key range of a table, from the header statistics.
+void table_info(int table_id, uint64_t *num_keys, uint64_t *min_key, uint64_t *max_key){
+    TableStats stats;
 
+    if(get_table_stats(table_id, &stats) != 0){
+        memset(&stats, 0, sizeof(TableStats));
+    }
+    *num_keys = stats.num_keys;
+    *min_key = stats.min_key;
+    *max_key = stats.max_key;
 }
 void write_output_buffer(FILE *file, uint64_t key1, char *value1, uint64_t key2, char *value2){
     OutputPage output;
@@ -1878,45 +4978,55 @@ void flush_output_page(FILE *file, Page *page){
 
     // Page is in buffer
     if(index != -1){
-        memcpy(buf_mgr[target_buf].frame, page, sizeof(Page));
-        buf_mgr[target_buf].is_dirty = 1;
+        memcpy(buf_mgr[index].frame, page, sizeof(Page));
+        buf_mgr[index].is_dirty = 1;
     }
     // Page is not in buffer
     else{
         // Ref bit is already turned on in is_in_buffer.
         buf_index = replace_page(file);
+
+        // Busy buffer pool : write result rows directly.
+        if(buf_index == -1){
+            write_output_rows(file, (OutputPage *)page);
+            return;
+        }
         // Setting new buffer // 
         // Page pointer is set already in replace_page function.
         // Memory allocation & Memory copy
         memcpy(buf_mgr[buf_index].frame, page, sizeof(Page));
-        buf_mgr[buf_index].table_id = -1;
-        buf_mgr[buf_index].page_offset = 0;
         // Setting dirty bit
-        buf_mgr[buf_index].is_dirty = 1;
-        buf_mgr[buf_index].refbit = 1;
+        install_frame(buf_index, -1, 0, 1);
     }
 }
 void sync_buffer(FILE *file){
-    int i, index, end;
-    OutputPage target;
+    int index;
 
     index = check_buffer_for_flush(-1, 0);
 
-    memcpy((Page *)&target, buf_mgr[index].frame, sizeof(Page));
-    for(int i = 0; i < target.file_offset; i++){
-        fprintf(file, "%" PRIu64 ",%s," "%" PRIu64 ",%s\n", RESULT_KEY1(&target, i), RESULT_VALUE1(&target, i), RESULT_KEY2(&target, i), RESULT_VALUE2(&target, i) );
+    // No result in buffer
+    if(index == -1){
+        return;
     }
 
+    write_output_rows(file, (OutputPage *)buf_mgr[index].frame);
+
     // Reinitialize : Evict
-    memset(buf_mgr[index].frame, 0, sizeof(Page));
-    buf_mgr[index].table_id = 0;
-    buf_mgr[index].page_offset = 0;
-    buf_mgr[index].is_dirty = 0;
-    buf_mgr[index].refbit = 0;
+    clear_frame(index);
+}
+// Write result rows of an output page. file_offset holds the number of rows.
+void write_output_rows(FILE *file, OutputPage *output){
+    int i;
+
+    for(i = 0; i < output->file_offset; i++){
+        fprintf(file, "%" PRIu64 ",%s," "%" PRIu64 ",%s\n", RESULT_KEY1(output, i), RESULT_VALUE1(output, i), RESULT_KEY2(output, i), RESULT_VALUE2(output, i) );
+    }
 }
 
 /* Project recovery */
 int begin_transaction(){
+    engine_lock();
+
     // Open Log file
     // Case 1 : Log file doesn't exist -> Create one
     if (log < 0) {
@@ -1924,6 +5034,7 @@ int begin_transaction(){
         log = open("log.db", O_CREAT|O_RDWR, S_IRUSR|S_IWUSR);
         if (log < 0) {
             assert("failed to create new log file");
+            engine_unlock();
             return -1;
         }
     }
@@ -1931,27 +5042,34 @@ int begin_transaction(){
 
     // Set transaction id.
     xid++;
+    in_transaction = 1;
     
     // Create log : type 0 ( BEGIN )
     create_log(0, 0, 0, 0, 0, NULL, NULL);
 
+    engine_unlock();
     return 0;
 }
 int commit_transaction(){
+    engine_lock();
+
     // Create log : type 2 ( COMMIT )
     create_log(2, 0, 0, 0, 0, NULL, NULL);
     flush_log(log_hand);
     fsync(log);
     log_hand = 0;
+    in_transaction = 0;
 
+    engine_unlock();
     return 0;
 }
 int abort_transaction(){
     off_t file_size, start = -1, end = -1, offset = 0;
-    int fix_point;
     LogRecord undo;
     LeafPage target;
 
+    engine_lock();
+
     /* Log file is already open. */
 
     // First, flush all log records.
@@ -1983,10 +5101,9 @@ int abort_transaction(){
 
         // Load page which is to be undone.
         load_page_from_buffer(undo.table_id, undo.pnum * PAGE_SIZE, (Page*)&target);
-        fix_point = (undo.offset - 128 - 8) / 128;
         
         // Undo
-        strcpy(LEAF_VALUE(&target,fix_point), undo.old_image);
+        strcpy(target.space + undo.offset, undo.old_image);
 
         // Change page lsn
         target.page_lsn = undo.prev_lsn;
@@ -2005,55 +5122,180 @@ int abort_transaction(){
     flush_log(log_hand);
     fsync(log);
     log_hand = 0;
+    in_transaction = 0;
 
+    engine_unlock();
     return 0;
 }
+/* Writes value over the record at index of a pinned leaf and logs the change.
+ * Images are logged as strings from the first changed byte :
+ * the unchanged head of the value is not logged.
+ * Returns 1 if the record changed, 0 if not, -1 if the log can't be opened.
+ */
+static int update_record(int table_id, LeafPage* leaf_node, int index, const char* value){
+    char *record = LEAF_VALUE(leaf_node, index);
+    char old[SIZE_VALUE], new[SIZE_VALUE];
+    int start, length, location;
+
+    // Case : same value. Nothing to write or log.
+    if(memcmp(record, value, SIZE_VALUE) == 0){
+        return 0;
+    }
+
+    // If log file doesn't exist, create.
+    if(log < 0){
+        log = open("log.db", O_CREAT|O_RDWR, S_IRUSR|S_IWUSR);
+        if(log < 0){
+            return -1;
+        }
+    }
+
+    // First changed byte of the strings
+    for(start = 0; start < SIZE_VALUE - 1 && record[start] == value[start] && record[start] != '\0'; start++);
+
+    // Copy images for logging : they fit the images of a log record.
+    length = SIZE_VALUE - 1 - start;
+    memcpy(old, record + start, length);
+    old[length] = '\0';
+    memcpy(new, value + start, length);
+    new[length] = '\0';
+
+    memcpy(record, value, SIZE_VALUE);
+
+    /* Set page's lsn */
+    leaf_node->page_lsn = lsn;
+
+    // Create log & push it into the buffer.
+    // TYPE : 1 ( UPDATE )
+    location = leaf_node->file_offset + (record + start - leaf_node->space);
+    create_log(1, table_id, location / PAGE_SIZE, location % PAGE_SIZE, strlen(new), old, new);
+
+    return 1;
+}
 int update(int table_id, int64_t key, char *value){
-    char old[120];
+    LeafPage* leaf_node;
+    int fix_point, changed;
+
+    engine_lock();
 
-    if(dbfile[table_id -1] == 0 || dbheader[table_id - 1].root_offset == 0 || find(table_id, key) == NULL){
-        // Not found : matching key OR Empty tree case
+    if(dbfile[table_id -1] == 0 || dbheader[table_id - 1].root_offset == 0){
+        // Empty tree case
+        engine_unlock();
         return -1;
     }
-    else{
-        // Found : matching key
-        LeafPage leaf_node;
-        int fix_point = 0, location;
 
-        // If log file doesn't exist, create.
-        log = open("log.db", O_RDWR);
-        if (log < 0) {
-            // Create a new log file
-            log = open("log.db", O_CREAT|O_RDWR, S_IRUSR|S_IWUSR);
-            if (log < 0) {
-                assert("failed to create new db file");
-                return -1;
-            }
-        }
+    // Modify the leaf in place.
+    leaf_node = find_leaf_pinned(table_id, key);
+    if(leaf_node == NULL){
+        engine_unlock();
+        return -1;
+    }
+
+    fix_point = LEAF_FIND(leaf_node, key);
+    if(fix_point == -1){
+        // Not found : matching key
+        buf_unpin((Page*)leaf_node, 0);
+        engine_unlock();
+        return -1;
+    }
 
-        find_leaf(table_id, key, &leaf_node);
+    // Found : matching key
+    changed = update_record(table_id, leaf_node, fix_point, value);
 
-	    while(fix_point < leaf_node.num_keys && LEAF_KEY(&leaf_node, fix_point) != key){
-		    fix_point++;
-        }
-        // Copy old image for logging
-        strcpy(old, LEAF_VALUE(&leaf_node, fix_point));
+    // Leaf node is written back by the buffer manager.
+    buf_unpin((Page*)leaf_node, changed == 1);
+
+    engine_unlock();
+    return changed == -1 ? -1 : 0;
+}
+int upsert(int table_id, uint64_t key, const char *value){
+    LeafPage* leaf_node;
+    TreePath path;
+    int fix_point, changed;
+
+    engine_lock();
+
+    // Failure case
+    if(table_id < 1 || table_id > 10 || dbfile[table_id - 1] <= 0 || value == NULL){
+        engine_unlock();
+        return -1;
+    }
 
-        memcpy(LEAF_VALUE(&leaf_node, fix_point), value, SIZE_VALUE);
+    if(insert_append(table_id, key, value)){
+        engine_unlock();
+        return 0;
+    }
 
-        /* Set page's lsn */
-        leaf_node.page_lsn = lsn;
+    // Case : empty tree.
+    if(dbheader[table_id - 1].root_offset == 0){
+        start_new_tree(table_id, key, value);
+        engine_unlock();
+        return 0;
+    }
 
-        // Create log & push it into the buffer.
-        // TYPE : 1 ( UPDATE )
-        location = leaf_node.file_offset + 128 + (fix_point * 128) + 8;
-        create_log(1, table_id, location / PAGE_SIZE, location % PAGE_SIZE, strlen(value), old,value);
+    leaf_node = find_leaf_path(table_id, key, &path);
+    if(leaf_node == NULL){
+        engine_unlock();
+        return -1;
+    }
 
-        // Flush leaf node to the file page
-        flush_page_to_buffer(table_id, (Page*)&leaf_node);
+    fix_point = LEAF_FIND(leaf_node, key);
 
+    // Case : new key. Insert it with the path of the descent.
+    if(fix_point == -1){
+        insert_into_tree(table_id, &path, leaf_node, key, value);
+        engine_unlock();
         return 0;
     }
+
+    // Case : key exists. Update the record in the leaf.
+    changed = update_record(table_id, leaf_node, fix_point, value);
+    buf_unpin((Page*)leaf_node, changed == 1);
+
+    engine_unlock();
+    return changed == -1 ? -1 : 0;
+}
+int modify(int table_id, uint64_t key, ModifyCallback callback, void *arg){
+    LeafPage* leaf_node;
+    char value[SIZE_VALUE];
+    int fix_point, changed;
+
+    engine_lock();
+
+    // Failure case
+    if(table_id < 1 || table_id > 10 || dbfile[table_id - 1] <= 0 || callback == NULL ||
+            dbheader[table_id - 1].root_offset == 0){
+        engine_unlock();
+        return -1;
+    }
+
+    leaf_node = find_leaf_pinned(table_id, key);
+    if(leaf_node == NULL){
+        engine_unlock();
+        return -1;
+    }
+
+    fix_point = LEAF_FIND(leaf_node, key);
+    if(fix_point == -1){
+        // Not found : matching key
+        buf_unpin((Page*)leaf_node, 0);
+        engine_unlock();
+        return -1;
+    }
+
+    // Callback works on a copy : the record is left as it is if it refuses.
+    memcpy(value, LEAF_VALUE(leaf_node, fix_point), SIZE_VALUE);
+    if(callback(arg, key, value) != 0){
+        buf_unpin((Page*)leaf_node, 0);
+        engine_unlock();
+        return -1;
+    }
+
+    changed = update_record(table_id, leaf_node, fix_point, value);
+    buf_unpin((Page*)leaf_node, changed == 1);
+
+    engine_unlock();
+    return changed == -1 ? -1 : 0;
 }
 // Create log record & push it into the buffer.
 void create_log(int type, int table_id, int pnum, int offset, int length, char *old_image, char *new_image){
@@ -2106,10 +5348,12 @@ void flush_log(int size){
 void recovery(){
     LogRecord redo;
     off_t file_size = 0, offset = 0, begin = -1, end = -1;
-    int i, fix_point = 0;
+    int i;
     char file[10] = "DATA";
     LeafPage target;
 
+    recovering = 1;
+
     // Determine the file size
     file_size = lseek(log, 0, SEEK_END);
 
@@ -2144,13 +5388,11 @@ void recovery(){
 
             // Load page which is to be redone.
             load_page_from_buffer(redo.table_id, redo.pnum * PAGE_SIZE, (Page*)&target);
-        
-            fix_point = (redo.offset - 128 - 8) / 128;
 
             // Compare page_lsn with log lsn then redo
             if(target.page_lsn <= redo.lsn){
-                // Redo
-                strcpy(LEAF_VALUE(&target,fix_point),redo.new_image);
+                // Redo : image goes at its offset in the page, whatever the leaf layout.
+                strcpy(target.space + redo.offset, redo.new_image);
 
                 // Change page lsn
                 target.page_lsn = redo.lsn;
@@ -2173,12 +5415,11 @@ void recovery(){
 
             // Load page which is to be undone.
             load_page_from_buffer(undo.table_id, undo.pnum * PAGE_SIZE, (Page*)&target);
-            fix_point = (undo.offset - 128 - 8) / 128;
 
             // Compare page_lsn with log lsn then undo
             if(target.page_lsn >= undo.lsn){
                 // Undo
-                strcpy(LEAF_VALUE(&target,fix_point), undo.old_image);
+                strcpy(target.space + undo.offset, undo.old_image);
 
                 // Change page lsn
                 target.page_lsn = undo.prev_lsn;
@@ -2190,9 +5431,13 @@ void recovery(){
     }
 
     // Flush result in buffer
-    for(i = 0; i < buf_size; i++){
-        if(buf_mgr[i].is_dirty == 1){
-            flush_page(buf_mgr[i].table_id, buf_mgr[i].frame);
+    flush_dirty_frames(0);
+
+    // Log is applied : tables opened for it can be converted now.
+    recovering = 0;
+    for(i = 0; i < 10; i++){
+        if(dbfile[i] > 0){
+            upgrade_leaf_format(i + 1);
         }
     }
 }
@@ -2208,14 +5453,50 @@ void execute_wal(int page_lsn){
             break;
     }
 
+    if(size > 0){
+        STATS_ADD(0, wal_flushes, 1);
+    }
     flush_log(size);
 }
+/* Checkpoint
+ * Every dirty frame has been written back, so the data files hold every logged change
+ * and the log can go. Otherwise recovery would replay update records at page offsets
+ * that unlogged inserts and deletes have since moved to other records.
+ */
+static void checkpoint_log(void){
+    int i;
+
+    if(log < 0){
+        return;
+    }
+
+    // Case : a page is still dirty. Its log records are needed.
+    for(i = 0; i < buf_size; i++){
+        if(buf_mgr[i].is_dirty == 1){
+            return;
+        }
+    }
+
+    // Pages written one by one, outside of a batch, are not synced yet.
+    for(i = 0; i < 10; i++){
+        if(dbfile[i] > 0){
+            fdatasync(dbfile[i]);
+        }
+    }
+
+    // Remove log file. & Reinitialize, as after recovery.
+    close(log);
+    remove("log.db");
+    log = -1;
+    log_hand = 0;
+    lsn = SIZE_LOG;
+}
 // If evicted page is not HeaderPage, return 1.
-int exclude_header(){
+int exclude_header(int buf_index){
     int i, size = 0;
     off_t target;
 
-    target = buf_mgr[clock_hand].page_offset;
+    target = buf_mgr[buf_index].page_offset;
 
     // Check number of open file.
     for(i = 0; i < 10; i++){
@@ -2233,10 +5514,10 @@ int exclude_header(){
     return 1;
 }
 // If evicted page is LeafPage, return page_lsn.
-int exclude_internal(){
+int exclude_internal(int buf_index){
     NodePage test;
 
-    memcpy(&test, buf_mgr[clock_hand].frame, sizeof(Page));
+    memcpy(&test, buf_mgr[buf_index].frame, sizeof(Page));
     
     if(test.is_leaf == 1){
         return test.page_lsn;
@@ -0,0 +1,208 @@
+/*
+ *  cursor.c
+ *
+ *  Range scans over the leaves of a table.
+ *  cursor_open descends once to the first record of the range,
+ *  cursor_next walks the records of the pinned leaf and moves
+ *  to the next leaf when they run out.
+ *
+ *  Forward scans follow the sibling chain, with read-ahead.
+ *  Leaves have no link to the left : reverse scans keep the path
+ *  of the descent and reach the leaf on the left through the lowest
+ *  ancestor with a child left of the path.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "bpt.h"
+#include "file.h"
+
+extern Buffer *buf_mgr;
+extern int buf_size;
+extern int dbfile[10];
+extern int open_cursors;
+
+// Pin the leaf on the left of the cursor's leaf and update the path.
+// NULL for the leftmost leaf.
+static LeafPage* cursor_left_leaf(Cursor *cursor){
+    TreePath *path = &cursor->path;
+    InternalPage *node;
+    off_t offset;
+    int level;
+
+    // Lowest ancestor with a child left of the path
+    for(level = path->height - 2; level >= 0; level--){
+        if(path->indexes[level] > 0){
+            break;
+        }
+    }
+    if(level < 0){
+        return NULL;
+    }
+
+    node = (InternalPage*)buf_pin(cursor->table_id, path->offsets[level]);
+    if(node == NULL){
+        return NULL;
+    }
+    path->indexes[level]--;
+    offset = INTERNAL_OFFSET(node, path->indexes[level]);
+    buf_unpin((Page*)node, 0);
+
+    // Rightmost leaf under that child
+    for(level++; level < path->height - 1; level++){
+        node = (InternalPage*)buf_pin(cursor->table_id, offset);
+        if(node == NULL){
+            return NULL;
+        }
+        path->offsets[level] = offset;
+        path->indexes[level] = node->num_keys;
+        offset = INTERNAL_OFFSET(node, node->num_keys);
+        buf_unpin((Page*)node, 0);
+    }
+    path->offsets[level] = offset;
+
+    return (LeafPage*)buf_pin_ring(&cursor->ring, cursor->table_id, offset);
+}
+
+Cursor* cursor_open(int table_id, uint64_t lo, uint64_t hi, int direction){
+    Cursor *cursor;
+    LeafPage *leaf;
+
+    engine_lock();
+
+    // Failure case
+    if(table_id < 1 || table_id > 10 || buf_size == -1 || buf_mgr == NULL || dbfile[table_id - 1] <= 0 ||
+            (direction != CURSOR_FORWARD && direction != CURSOR_REVERSE)){
+        engine_unlock();
+        return NULL;
+    }
+
+    cursor = (Cursor*)malloc(sizeof(Cursor));
+    if(cursor == NULL){
+        engine_unlock();
+        return NULL;
+    }
+    cursor->table_id = table_id;
+    cursor->direction = direction;
+    cursor->lo = lo;
+    cursor->hi = hi;
+    cursor->leaf = NULL;
+    cursor->index = 0;
+    open_cursors++;
+
+    // Leaves are scanned through a private ring : hot pages stay in the pool.
+    buf_ring_init(&cursor->ring);
+    readahead_init(&cursor->ra, table_id, &cursor->ring);
+
+    // Case : empty range.
+    if(lo > hi){
+        engine_unlock();
+        return cursor;
+    }
+
+    if(direction == CURSOR_FORWARD){
+        // First key >= lo
+        leaf = find_leaf_path(table_id, lo, NULL);
+        if(leaf != NULL){
+            cursor->index = LEAF_SEARCH(leaf, lo);
+        }
+    }
+    else{
+        // Last key <= hi
+        leaf = find_leaf_path(table_id, hi, &cursor->path);
+        if(leaf != NULL){
+            cursor->index = search_upper(LEAF_KEYS(leaf), LEAF_KEY_STRIDE, leaf->num_keys, hi) - 1;
+        }
+    }
+    cursor->leaf = leaf;
+
+    engine_unlock();
+    return cursor;
+}
+
+int cursor_next(Cursor *cursor, uint64_t *key, const char **value){
+    int forward, result = 0;
+    LeafPage *leaf;
+    off_t sibling;
+    uint64_t k;
+
+    // Failure case
+    if(cursor == NULL){
+        return -1;
+    }
+
+    engine_lock();
+
+    forward = cursor->direction == CURSOR_FORWARD;
+    while(cursor->leaf != NULL){
+        leaf = cursor->leaf;
+
+        // Case : record left in this leaf.
+        if(cursor->index >= 0 && cursor->index < leaf->num_keys){
+            k = LEAF_KEY(leaf, cursor->index);
+            // Case : end of the range.
+            if(forward ? k > cursor->hi : k < cursor->lo){
+                break;
+            }
+            *key = k;
+            *value = LEAF_VALUE(leaf, cursor->index);
+            cursor->index += forward ? 1 : -1;
+
+            engine_unlock();
+            return 1;
+        }
+
+        // Case : leaf is done. Move to the next one.
+        if(forward){
+            sibling = leaf->sibling;
+            if(sibling == 0){
+                break;
+            }
+            readahead_leaf(&cursor->ra, leaf);
+            buf_unpin((Page*)leaf, 0);
+            cursor->leaf = (LeafPage*)buf_pin_ring(&cursor->ring, cursor->table_id, sibling);
+            cursor->index = 0;
+            // Every frame is pinned
+            if(cursor->leaf == NULL){
+                result = -1;
+            }
+        }
+        else{
+            buf_unpin((Page*)leaf, 0);
+            cursor->leaf = cursor_left_leaf(cursor);
+            if(cursor->leaf != NULL){
+                cursor->index = cursor->leaf->num_keys - 1;
+            }
+        }
+    }
+
+    // End of the range : release the leaf now.
+    if(cursor->leaf != NULL){
+        buf_unpin((Page*)cursor->leaf, 0);
+        cursor->leaf = NULL;
+    }
+
+    engine_unlock();
+    return result;
+}
+
+int cursor_close(Cursor *cursor){
+    // Failure case
+    if(cursor == NULL){
+        return -1;
+    }
+
+    engine_lock();
+
+    if(cursor->leaf != NULL){
+        buf_unpin((Page*)cursor->leaf, 0);
+    }
+    buf_ring_free(&cursor->ring);
+    open_cursors--;
+
+    engine_unlock();
+
+    free(cursor);
+    return 0;
+}
@@ -1,15 +1,23 @@
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include "bpt.h"
 #include "file.h"
 
 HeaderPage dbheader[10] = {0,};
 int dbfile[10] = {0,};
 
+// Direct I/O mode : data files bypass the kernel page cache. Set by init_db_ex.
+int direct_io = 0;
+
 // Get free page to use.
 // If no more free page exist, expand file
 off_t get_free_page(int table_id) {
@@ -46,6 +54,28 @@ void put_free_page(int table_id, off_t page_offset) {
     flush_page_to_buffer(table_id, (Page*)(dbheader + table_id - 1));
 }
 
+// Put pages to the free list in one batch.
+// The pages are chained in order, the header is written once.
+void put_free_pages(int table_id, const off_t *page_offsets, int count) {
+    FreePage freepage;
+    int i;
+
+    if (count <= 0) {
+        return;
+    }
+
+    memset(&freepage, 0, PAGE_SIZE);
+    for (i = 0; i < count; i++) {
+        freepage.next = i + 1 < count ? page_offsets[i + 1] : dbheader[table_id - 1].freelist;
+        freepage.file_offset = page_offsets[i];
+        flush_page_to_buffer(table_id, (Page*)&freepage);
+    }
+
+    dbheader[table_id - 1].freelist = page_offsets[0];
+
+    flush_page_to_buffer(table_id, (Page*)(dbheader + table_id - 1));
+}
+
 // Expand file pages and prepend them to the free list
 void expand_file(int table_id, size_t cnt_page_to_expand) {
     off_t offset = dbheader[table_id - 1].num_pages * PAGE_SIZE;
@@ -65,13 +95,165 @@ void expand_file(int table_id, size_t cnt_page_to_expand) {
     flush_page_to_buffer(table_id, (Page*)(dbheader + table_id - 1));
 }
 
+// Open a data file. In direct I/O mode, fall back to buffered I/O
+// if the file system does not support O_DIRECT.
+int open_page_file(const char* filename, int flags, mode_t mode) {
+    int fd;
+
+    if (direct_io) {
+        fd = open(filename, flags | O_DIRECT, mode);
+        if (fd >= 0 || errno != EINVAL) {
+            return fd;
+        }
+    }
+    return open(filename, flags, mode);
+}
+
+// Positioned I/O : the background writer shares the file descriptors.
+// Frames are not aligned (in-memory data follows the page),
+// so direct I/O goes through an aligned bounce buffer.
 void load_page(int table_id, off_t offset, Page* page) {
-    lseek(dbfile[table_id - 1], offset, SEEK_SET);
-    read(dbfile[table_id - 1], page, PAGE_SIZE);
+    char bounce[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+    uint64_t start = stats_clock();
+    ssize_t len;
+
+    if (direct_io) {
+        len = pread(dbfile[table_id - 1], bounce, PAGE_SIZE, offset);
+        // Page past the end of file : keep the page as it is, like read.
+        if (len > 0) {
+            memcpy(page, bounce, len);
+        }
+    }
+    else {
+        pread(dbfile[table_id - 1], page, PAGE_SIZE, offset);
+    }
     page->file_offset = offset;
+    stats_io(table_id, 0, PAGE_SIZE, start);
 }
 
 void flush_page(int table_id, Page* page) {
-    lseek(dbfile[table_id - 1], page->file_offset, SEEK_SET);
-    write(dbfile[table_id - 1], page, PAGE_SIZE);
+    char bounce[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+    uint64_t start = stats_clock();
+
+    if (direct_io) {
+        memcpy(bounce, page, PAGE_SIZE);
+        pwrite(dbfile[table_id - 1], bounce, PAGE_SIZE, page->file_offset);
+    }
+    else {
+        pwrite(dbfile[table_id - 1], page, PAGE_SIZE, page->file_offset);
+    }
+    stats_io(table_id, 1, PAGE_SIZE, start);
+}
+
+static int compare_offset(const void *a, const void *b) {
+    off_t x = *(const off_t*)a, y = *(const off_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+void prefetch_pages(int table_id, off_t *offsets, int count) {
+    off_t sorted[count > 0 ? count : 1];
+    off_t start;
+    int i, run;
+
+    // Page cache is bypassed : nothing to read ahead into.
+    if (count <= 0 || direct_io) {
+        return;
+    }
+
+    memcpy(sorted, offsets, sizeof(off_t) * count);
+    qsort(sorted, count, sizeof(off_t), compare_offset);
+
+    // One request per run of contiguous pages.
+    start = sorted[0];
+    run = 1;
+    for (i = 1; i <= count; i++) {
+        if (i < count && sorted[i] == sorted[i - 1]) {
+            continue;
+        }
+        if (i < count && sorted[i] == start + (off_t)run * PAGE_SIZE) {
+            run++;
+            continue;
+        }
+        posix_fadvise(dbfile[table_id - 1], start, (off_t)run * PAGE_SIZE, POSIX_FADV_WILLNEED);
+        if (i < count) {
+            start = sorted[i];
+            run = 1;
+        }
+    }
+}
+
+static int compare_page_io(const void *a, const void *b) {
+    const PageIO *x = (const PageIO*)a, *y = (const PageIO*)b;
+
+    if (x->table_id != y->table_id) {
+        return x->table_id - y->table_id;
+    }
+    return (x->page->file_offset > y->page->file_offset) - (x->page->file_offset < y->page->file_offset);
+}
+
+// Write a run of adjacent pages of one file with a single system call.
+static void write_run(PageIO *ios, int run, char *staging) {
+    struct iovec iov[WRITEBACK_MAX_RUN];
+    size_t len = (size_t)run * PAGE_SIZE;
+    uint64_t start = stats_clock();
+    ssize_t written;
+    int i, fd = dbfile[ios[0].table_id - 1];
+
+    // Direct I/O : frames are not aligned, gather the run into the staging area.
+    if (direct_io) {
+        for (i = 0; i < run; i++) {
+            memcpy(staging + (size_t)i * PAGE_SIZE, ios[i].page, PAGE_SIZE);
+        }
+        written = pwrite(fd, staging, len, ios[0].page->file_offset);
+    }
+    else {
+        for (i = 0; i < run; i++) {
+            iov[i].iov_base = ios[i].page;
+            iov[i].iov_len = PAGE_SIZE;
+        }
+        written = pwritev(fd, iov, run, ios[0].page->file_offset);
+    }
+
+    // Short or failed write : write the pages one by one.
+    if (written != (ssize_t)len) {
+        for (i = 0; i < run; i++) {
+            flush_page(ios[i].table_id, ios[i].page);
+        }
+        return;
+    }
+    stats_io(ios[0].table_id, 1, len, start);
+}
+
+void writeback_pages(PageIO *ios, int count) {
+    char *staging = NULL;
+    int start, run;
+
+    if (count <= 0) {
+        return;
+    }
+    if (direct_io && posix_memalign((void**)&staging, PAGE_SIZE, WRITEBACK_MAX_RUN * PAGE_SIZE) != 0) {
+        flush_pages(ios, count);
+        return;
+    }
+
+    qsort(ios, count, sizeof(PageIO), compare_page_io);
+
+    for (start = 0; start < count; start += run) {
+        // Adjacent pages of the same file make one run.
+        run = 1;
+        while (start + run < count && run < WRITEBACK_MAX_RUN &&
+                ios[start + run].table_id == ios[start].table_id &&
+                ios[start + run].page->file_offset == ios[start].page->file_offset + (off_t)run * PAGE_SIZE) {
+            run++;
+        }
+        write_run(ios + start, run, staging);
+
+        // Last run of the file : sync it once.
+        if (start + run == count || ios[start + run].table_id != ios[start].table_id) {
+            fdatasync(dbfile[ios[start].table_id - 1]);
+        }
+    }
+
+    free(staging);
 }
@@ -0,0 +1,742 @@
+/*
+ *  policy.c
+ *
+ *  Page replacement policies of the buffer manager.
+ *  Each policy keeps its own bookkeeping over buffer indexes
+ *  and is driven by replace_page through ReplacementPolicy hooks.
+ *
+ *  CLOCK : single reference bit clock (original policy)
+ *  LRU-K : LRU-2, evict the largest backward 2-distance
+ *  2Q    : A1in FIFO + A1out ghost + Am LRU (Johnson & Shasha)
+ *  ARC   : adaptive T1/T2 with B1/B2 ghosts (Megiddo & Modha)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "bpt.h"
+#include "file.h"
+
+extern Buffer *buf_mgr;
+extern int buf_size;
+extern int clock_hand;
+
+/* Frame lists : doubly linked lists over buffer indexes.
+ * A frame is in at most one list at a time.
+ */
+#define LIST_NONE   -1
+
+typedef struct _FrameList {
+    int head;       // LRU end
+    int tail;       // MRU end
+    int size;
+} FrameList;
+
+static int *list_prev;
+static int *list_next;
+static int *list_of;
+
+/* Ghost lists : pages recently evicted, remembered by key only. */
+typedef struct _Ghost {
+    int table_id;
+    off_t page_offset;
+    int list;
+    int prev;
+    int next;
+    int hash_next;
+    // LRU-K : last reference time of the evicted page
+    uint64_t hist;
+} Ghost;
+
+static Ghost *ghosts;
+static int *ghost_table;
+static int ghost_mask;
+static int ghost_free;
+static FrameList ghost_lists[2];
+
+/* Policies allocate their arrays before releasing the current ones :
+ * a failed init leaves the policy as it was.
+ */
+static int frame_lists_alloc(int num_buf, int **prev, int **next, int **of){
+    *prev = (int *)malloc(num_buf * sizeof(int));
+    *next = (int *)malloc(num_buf * sizeof(int));
+    *of = (int *)malloc(num_buf * sizeof(int));
+    if(*prev == NULL || *next == NULL || *of == NULL){
+        free(*prev);
+        free(*next);
+        free(*of);
+        return -1;
+    }
+    return 0;
+}
+
+static void frame_lists_destroy(void){
+    free(list_prev);
+    free(list_next);
+    free(list_of);
+    list_prev = list_next = list_of = NULL;
+}
+
+// Replace the lists with arrays from frame_lists_alloc.
+static void frame_lists_set(int num_buf, int *prev, int *next, int *of){
+    int i;
+
+    frame_lists_destroy();
+    list_prev = prev;
+    list_next = next;
+    list_of = of;
+    for(i = 0; i < num_buf; i++){
+        list_prev[i] = list_next[i] = -1;
+        list_of[i] = LIST_NONE;
+    }
+}
+
+// Append a frame to the MRU end.
+static void list_push(FrameList *list, int list_id, int buf_index){
+    list_prev[buf_index] = list->tail;
+    list_next[buf_index] = -1;
+    if(list->tail != -1){
+        list_next[list->tail] = buf_index;
+    }
+    else{
+        list->head = buf_index;
+    }
+    list->tail = buf_index;
+    list->size++;
+    list_of[buf_index] = list_id;
+}
+
+static void list_unlink(FrameList *list, int buf_index){
+    if(list_prev[buf_index] != -1){
+        list_next[list_prev[buf_index]] = list_next[buf_index];
+    }
+    else{
+        list->head = list_next[buf_index];
+    }
+    if(list_next[buf_index] != -1){
+        list_prev[list_next[buf_index]] = list_prev[buf_index];
+    }
+    else{
+        list->tail = list_prev[buf_index];
+    }
+    list_prev[buf_index] = list_next[buf_index] = -1;
+    list->size--;
+    list_of[buf_index] = LIST_NONE;
+}
+
+// First evictable frame from the LRU end, -1 if none.
+static int list_victim(FrameList *list, FILE *file){
+    int i;
+
+    for(i = list->head; i != -1; i = list_next[i]){
+        if(frame_evictable(i, file)){
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int ghost_hash(int table_id, off_t page_offset){
+    uint64_t h;
+
+    h = (uint64_t)(page_offset / PAGE_SIZE) * 0x9E3779B97F4A7C15ULL;
+    h ^= (uint64_t)(int64_t)table_id * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 29;
+
+    return (int)(h & ghost_mask);
+}
+
+// Power of two buckets, at least twice the capacity.
+static int ghost_buckets(int capacity){
+    int buckets = 1;
+
+    while(buckets < capacity * 2){
+        buckets <<= 1;
+    }
+    return buckets;
+}
+
+static int ghosts_alloc(int capacity, Ghost **entries, int **table){
+    *entries = (Ghost *)malloc(capacity * sizeof(Ghost));
+    *table = (int *)malloc(ghost_buckets(capacity) * sizeof(int));
+    if(*entries == NULL || *table == NULL){
+        free(*entries);
+        free(*table);
+        return -1;
+    }
+    return 0;
+}
+
+static void ghosts_destroy(void){
+    free(ghosts);
+    free(ghost_table);
+    ghosts = NULL;
+    ghost_table = NULL;
+}
+
+// Replace the ghost list with arrays from ghosts_alloc.
+static void ghosts_set(int capacity, Ghost *entries, int *table){
+    int i;
+
+    ghosts_destroy();
+    ghosts = entries;
+    ghost_table = table;
+    ghost_mask = ghost_buckets(capacity);
+    for(i = 0; i < ghost_mask; i++){
+        ghost_table[i] = -1;
+    }
+    ghost_mask--;
+
+    // Free entries are chained through next.
+    for(i = 0; i < capacity; i++){
+        ghosts[i].next = i + 1 < capacity ? i + 1 : -1;
+    }
+    ghost_free = 0;
+    for(i = 0; i < 2; i++){
+        ghost_lists[i].head = ghost_lists[i].tail = -1;
+        ghost_lists[i].size = 0;
+    }
+}
+
+static int ghost_find(int table_id, off_t page_offset){
+    int g;
+
+    for(g = ghost_table[ghost_hash(table_id, page_offset)]; g != -1; g = ghosts[g].hash_next){
+        if(ghosts[g].table_id == table_id && ghosts[g].page_offset == page_offset){
+            return g;
+        }
+    }
+    return -1;
+}
+
+static void ghost_remove(int g){
+    FrameList *list = &ghost_lists[ghosts[g].list];
+    int *link;
+
+    if(ghosts[g].prev != -1){
+        ghosts[ghosts[g].prev].next = ghosts[g].next;
+    }
+    else{
+        list->head = ghosts[g].next;
+    }
+    if(ghosts[g].next != -1){
+        ghosts[ghosts[g].next].prev = ghosts[g].prev;
+    }
+    else{
+        list->tail = ghosts[g].prev;
+    }
+    list->size--;
+
+    link = &ghost_table[ghost_hash(ghosts[g].table_id, ghosts[g].page_offset)];
+    while(*link != g){
+        link = &ghosts[*link].hash_next;
+    }
+    *link = ghosts[g].hash_next;
+
+    ghosts[g].next = ghost_free;
+    ghost_free = g;
+}
+
+// Remember an evicted page at the MRU end of a ghost list.
+// Caller keeps the total number of ghosts within capacity.
+static int ghost_push(int list_id, int table_id, off_t page_offset){
+    FrameList *list = &ghost_lists[list_id];
+    int g, bucket;
+
+    g = ghost_free;
+    if(g == -1){
+        return -1;
+    }
+    ghost_free = ghosts[g].next;
+
+    ghosts[g].table_id = table_id;
+    ghosts[g].page_offset = page_offset;
+    ghosts[g].list = list_id;
+    ghosts[g].prev = list->tail;
+    ghosts[g].next = -1;
+    if(list->tail != -1){
+        ghosts[list->tail].next = g;
+    }
+    else{
+        list->head = g;
+    }
+    list->tail = g;
+    list->size++;
+
+    bucket = ghost_hash(table_id, page_offset);
+    ghosts[g].hash_next = ghost_table[bucket];
+    ghost_table[bucket] = g;
+
+    return g;
+}
+
+/* CLOCK */
+static int clock_init(int num_buf){
+    (void)num_buf;
+
+    clock_hand = 0;
+    return 0;
+}
+
+static void clock_destroy(void){
+}
+
+static void clock_hit(int buf_index){
+    buf_mgr[buf_index].refbit = 1;
+}
+
+static void clock_remove(int buf_index, int evicted){
+    (void)evicted;
+
+    buf_mgr[buf_index].refbit = 0;
+}
+
+static int clock_victim(FILE *file){
+    int sweep;
+
+    // Spin at most two cycles : the first one may only clear reference bits.
+    for(sweep = 0; sweep <= 2 * buf_size; sweep++){
+        if(frame_evictable(clock_hand, file)){
+            /* Check refernce bit */
+            // Case : reference bit is off.
+            if(buf_mgr[clock_hand].refbit == 0){
+                STATS_ADD(0, clock_sweeps, sweep + 1);
+                return clock_hand;
+            }
+            // Case : reference bit is on. Turn off the reference bit.
+            buf_mgr[clock_hand].refbit = 0;
+        }
+
+        // Move clock hand
+        clock_hand = (clock_hand + 1) % buf_size;
+    }
+    STATS_ADD(0, clock_sweeps, sweep);
+
+    // Busy buffer pool
+    return -1;
+}
+
+ReplacementPolicy policy_clock = {
+    "CLOCK", clock_init, clock_destroy, clock_hit, clock_hit, clock_remove, clock_victim
+};
+
+/* LRU-K (K = 2)
+ * Victim has the oldest second-to-last reference. Frames referenced once
+ * have an infinite backward distance and go first, oldest reference first.
+ * Frames are kept in a binary min-heap on (hist2, hist1).
+ * Last reference time of evicted pages is retained in a ghost list,
+ * so a page coming back is not treated as referenced once.
+ */
+// Correlated reference period : re-references within this many
+// buffer accesses count as one reference (e.g. find + find_leaf in insert).
+#define LRU_K_CRP   4
+
+static uint64_t lru_tick;
+static uint64_t *hist1;
+static uint64_t *hist2;
+static int *heap;
+static int *heap_pos;
+static int heap_size;
+
+static int lruk_less(int a, int b){
+    if(hist2[a] != hist2[b]){
+        return hist2[a] < hist2[b];
+    }
+    return hist1[a] < hist1[b];
+}
+
+static void heap_swap(int i, int j){
+    int t = heap[i];
+
+    heap[i] = heap[j];
+    heap[j] = t;
+    heap_pos[heap[i]] = i;
+    heap_pos[heap[j]] = j;
+}
+
+static void heap_up(int i){
+    while(i > 0 && lruk_less(heap[i], heap[(i - 1) / 2])){
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(int i){
+    int child;
+
+    while((child = 2 * i + 1) < heap_size){
+        if(child + 1 < heap_size && lruk_less(heap[child + 1], heap[child])){
+            child++;
+        }
+        if(!lruk_less(heap[child], heap[i])){
+            break;
+        }
+        heap_swap(i, child);
+        i = child;
+    }
+}
+
+static void heap_delete(int buf_index){
+    int i = heap_pos[buf_index];
+    int moved;
+
+    heap_pos[buf_index] = -1;
+    heap_size--;
+    if(i == heap_size){
+        return;
+    }
+    moved = heap[heap_size];
+    heap[i] = moved;
+    heap_pos[moved] = i;
+    heap_up(i);
+    heap_down(heap_pos[moved]);
+}
+
+static void lruk_destroy(void);
+
+static int lruk_init(int num_buf){
+    uint64_t *new_hist1, *new_hist2;
+    int *new_heap, *new_heap_pos, *new_ghost_table;
+    Ghost *new_ghosts;
+    int i;
+
+    new_hist1 = (uint64_t *)calloc(num_buf, sizeof(uint64_t));
+    new_hist2 = (uint64_t *)calloc(num_buf, sizeof(uint64_t));
+    new_heap = (int *)malloc(num_buf * sizeof(int));
+    new_heap_pos = (int *)malloc(num_buf * sizeof(int));
+    if(new_hist1 == NULL || new_hist2 == NULL || new_heap == NULL || new_heap_pos == NULL ||
+            ghosts_alloc(num_buf, &new_ghosts, &new_ghost_table) != 0){
+        free(new_hist1);
+        free(new_hist2);
+        free(new_heap);
+        free(new_heap_pos);
+        return -1;
+    }
+
+    lruk_destroy();
+    lru_tick = 0;
+    heap_size = 0;
+    hist1 = new_hist1;
+    hist2 = new_hist2;
+    heap = new_heap;
+    heap_pos = new_heap_pos;
+    for(i = 0; i < num_buf; i++){
+        heap_pos[i] = -1;
+    }
+    ghosts_set(num_buf, new_ghosts, new_ghost_table);
+    return 0;
+}
+
+static void lruk_destroy(void){
+    free(hist1);
+    free(hist2);
+    free(heap);
+    free(heap_pos);
+    hist1 = hist2 = NULL;
+    heap = heap_pos = NULL;
+    ghosts_destroy();
+}
+
+static void lruk_hit(int buf_index){
+    if(heap_pos[buf_index] == -1){
+        return;
+    }
+    // Correlated reference : only refresh the last reference.
+    if(lru_tick - hist1[buf_index] > LRU_K_CRP){
+        hist2[buf_index] = hist1[buf_index];
+    }
+    hist1[buf_index] = ++lru_tick;
+    // Key only grows.
+    heap_down(heap_pos[buf_index]);
+}
+
+static void lruk_fill(int buf_index){
+    int g;
+
+    // Retained history : the page was evicted before.
+    g = ghost_find(buf_mgr[buf_index].table_id, buf_mgr[buf_index].page_offset);
+    if(g != -1){
+        hist2[buf_index] = ghosts[g].hist;
+        ghost_remove(g);
+    }
+    else{
+        hist2[buf_index] = 0;
+    }
+    hist1[buf_index] = ++lru_tick;
+
+    heap[heap_size] = buf_index;
+    heap_pos[buf_index] = heap_size;
+    heap_size++;
+    heap_up(heap_size - 1);
+}
+
+static void lruk_remove(int buf_index, int evicted){
+    int g;
+
+    if(heap_pos[buf_index] == -1){
+        return;
+    }
+    heap_delete(buf_index);
+
+    if(evicted){
+        if(ghost_lists[0].size >= buf_size){
+            ghost_remove(ghost_lists[0].head);
+        }
+        g = ghost_push(0, buf_mgr[buf_index].table_id, buf_mgr[buf_index].page_offset);
+        ghosts[g].hist = hist1[buf_index];
+    }
+}
+
+static int lruk_victim(FILE *file){
+    int i, best = -1;
+
+    // Case : root is evictable. Nearly always.
+    if(heap_size > 0 && frame_evictable(heap[0], file)){
+        return heap[0];
+    }
+
+    // Case : root is pinned. Fall back to a scan over the heap.
+    for(i = 0; i < heap_size; i++){
+        if(frame_evictable(heap[i], file) && (best == -1 || lruk_less(heap[i], best))){
+            best = heap[i];
+        }
+    }
+    return best;
+}
+
+ReplacementPolicy policy_lru_k = {
+    "LRU-K", lruk_init, lruk_destroy, lruk_hit, lruk_fill, lruk_remove, lruk_victim
+};
+
+/* 2Q */
+#define Q_A1IN  0
+#define Q_AM    1
+
+static FrameList q_lists[2];
+static int q_kin;
+static int q_kout;
+
+static int twoq_init(int num_buf){
+    int *prev, *next, *of, *new_ghost_table;
+    int kout = num_buf / 2 > 0 ? num_buf / 2 : 1;
+    Ghost *new_ghosts;
+
+    if(frame_lists_alloc(num_buf, &prev, &next, &of) != 0){
+        return -1;
+    }
+    if(ghosts_alloc(kout, &new_ghosts, &new_ghost_table) != 0){
+        free(prev);
+        free(next);
+        free(of);
+        return -1;
+    }
+
+    q_kin = num_buf / 4 > 0 ? num_buf / 4 : 1;
+    q_kout = kout;
+    q_lists[Q_A1IN].head = q_lists[Q_A1IN].tail = -1;
+    q_lists[Q_A1IN].size = 0;
+    q_lists[Q_AM] = q_lists[Q_A1IN];
+    frame_lists_set(num_buf, prev, next, of);
+    ghosts_set(q_kout, new_ghosts, new_ghost_table);
+    return 0;
+}
+
+static void twoq_destroy(void){
+    frame_lists_destroy();
+    ghosts_destroy();
+}
+
+static void twoq_hit(int buf_index){
+    // A1in is a FIFO : correlated references do not promote.
+    if(list_of[buf_index] == Q_AM){
+        list_unlink(&q_lists[Q_AM], buf_index);
+        list_push(&q_lists[Q_AM], Q_AM, buf_index);
+    }
+}
+
+static void twoq_fill(int buf_index){
+    int g;
+
+    g = ghost_find(buf_mgr[buf_index].table_id, buf_mgr[buf_index].page_offset);
+    if(g != -1){
+        // Re-referenced after leaving A1in : hot page.
+        ghost_remove(g);
+        list_push(&q_lists[Q_AM], Q_AM, buf_index);
+    }
+    else{
+        list_push(&q_lists[Q_A1IN], Q_A1IN, buf_index);
+    }
+}
+
+static void twoq_remove(int buf_index, int evicted){
+    int list_id = list_of[buf_index];
+
+    if(list_id == LIST_NONE){
+        return;
+    }
+    list_unlink(&q_lists[list_id], buf_index);
+
+    if(evicted && list_id == Q_A1IN){
+        if(ghost_lists[0].size >= q_kout){
+            ghost_remove(ghost_lists[0].head);
+        }
+        ghost_push(0, buf_mgr[buf_index].table_id, buf_mgr[buf_index].page_offset);
+    }
+}
+
+static int twoq_victim(FILE *file){
+    int target = -1;
+
+    if(q_lists[Q_A1IN].size > q_kin || q_lists[Q_AM].size == 0){
+        target = list_victim(&q_lists[Q_A1IN], file);
+    }
+    if(target == -1){
+        target = list_victim(&q_lists[Q_AM], file);
+    }
+    if(target == -1){
+        target = list_victim(&q_lists[Q_A1IN], file);
+    }
+    return target;
+}
+
+ReplacementPolicy policy_2q = {
+    "2Q", twoq_init, twoq_destroy, twoq_hit, twoq_fill, twoq_remove, twoq_victim
+};
+
+/* ARC */
+#define ARC_T1  0
+#define ARC_T2  1
+#define ARC_B1  0
+#define ARC_B2  1
+
+static FrameList arc_lists[2];
+static int arc_c;
+static int arc_p;
+
+static int arc_init(int num_buf){
+    int *prev, *next, *of, *new_ghost_table;
+    Ghost *new_ghosts;
+
+    if(frame_lists_alloc(num_buf, &prev, &next, &of) != 0){
+        return -1;
+    }
+    if(ghosts_alloc(num_buf, &new_ghosts, &new_ghost_table) != 0){
+        free(prev);
+        free(next);
+        free(of);
+        return -1;
+    }
+
+    arc_c = num_buf;
+    arc_p = 0;
+    arc_lists[ARC_T1].head = arc_lists[ARC_T1].tail = -1;
+    arc_lists[ARC_T1].size = 0;
+    arc_lists[ARC_T2] = arc_lists[ARC_T1];
+    frame_lists_set(num_buf, prev, next, of);
+    ghosts_set(num_buf, new_ghosts, new_ghost_table);
+    return 0;
+}
+
+static void arc_destroy(void){
+    frame_lists_destroy();
+    ghosts_destroy();
+}
+
+static void arc_hit(int buf_index){
+    int list_id = list_of[buf_index];
+
+    if(list_id == LIST_NONE){
+        return;
+    }
+    list_unlink(&arc_lists[list_id], buf_index);
+    list_push(&arc_lists[ARC_T2], ARC_T2, buf_index);
+}
+
+static void arc_fill(int buf_index){
+    int g, b1, b2, delta;
+
+    g = ghost_find(buf_mgr[buf_index].table_id, buf_mgr[buf_index].page_offset);
+    b1 = ghost_lists[ARC_B1].size;
+    b2 = ghost_lists[ARC_B2].size;
+
+    // Case : ghost hit in B1. Recency side was too small.
+    if(g != -1 && ghosts[g].list == ARC_B1){
+        delta = b2 > b1 ? b2 / b1 : 1;
+        arc_p = arc_p + delta < arc_c ? arc_p + delta : arc_c;
+        ghost_remove(g);
+        list_push(&arc_lists[ARC_T2], ARC_T2, buf_index);
+    }
+    // Case : ghost hit in B2. Frequency side was too small.
+    else if(g != -1){
+        delta = b1 > b2 ? b1 / b2 : 1;
+        arc_p = arc_p - delta > 0 ? arc_p - delta : 0;
+        ghost_remove(g);
+        list_push(&arc_lists[ARC_T2], ARC_T2, buf_index);
+    }
+    // Case : new page.
+    else{
+        list_push(&arc_lists[ARC_T1], ARC_T1, buf_index);
+    }
+}
+
+static void arc_remove(int buf_index, int evicted){
+    int list_id = list_of[buf_index];
+
+    if(list_id == LIST_NONE){
+        return;
+    }
+    list_unlink(&arc_lists[list_id], buf_index);
+
+    if(!evicted){
+        return;
+    }
+
+    // Keep |T1| + |B1| <= c and |B1| + |B2| <= c.
+    if(list_id == ARC_T1 && arc_lists[ARC_T1].size + ghost_lists[ARC_B1].size >= arc_c && ghost_lists[ARC_B1].size > 0){
+        ghost_remove(ghost_lists[ARC_B1].head);
+    }
+    if(ghost_lists[ARC_B1].size + ghost_lists[ARC_B2].size >= arc_c){
+        if(ghost_lists[ARC_B2].size > 0){
+            ghost_remove(ghost_lists[ARC_B2].head);
+        }
+        else{
+            ghost_remove(ghost_lists[ARC_B1].head);
+        }
+    }
+    ghost_push(list_id == ARC_T1 ? ARC_B1 : ARC_B2, buf_mgr[buf_index].table_id, buf_mgr[buf_index].page_offset);
+}
+
+static int arc_victim(FILE *file){
+    int target = -1;
+
+    if(arc_lists[ARC_T1].size > 0 && (arc_lists[ARC_T1].size > arc_p || arc_lists[ARC_T2].size == 0)){
+        target = list_victim(&arc_lists[ARC_T1], file);
+    }
+    if(target == -1){
+        target = list_victim(&arc_lists[ARC_T2], file);
+    }
+    if(target == -1){
+        target = list_victim(&arc_lists[ARC_T1], file);
+    }
+    return target;
+}
+
+ReplacementPolicy policy_arc = {
+    "ARC", arc_init, arc_destroy, arc_hit, arc_fill, arc_remove, arc_victim
+};
+
+// Policy table indexed by BUF_POLICY_* number.
+ReplacementPolicy* get_replacement_policy(int policy){
+    switch(policy){
+    case BUF_POLICY_CLOCK:
+        return &policy_clock;
+    case BUF_POLICY_LRU_K:
+        return &policy_lru_k;
+    case BUF_POLICY_2Q:
+        return &policy_2q;
+    case BUF_POLICY_ARC:
+        return &policy_arc;
+    default:
+        return NULL;
+    }
+}
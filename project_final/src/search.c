@@ -0,0 +1,133 @@
+/*
+ *  search.c
+ *
+ *  Key search inside a node.
+ *  Keys of a node are seen as an array with a stride :
+ *  internal keys are 16 bytes apart (key, offset), leaf keys are contiguous.
+ *
+ *  Branch-free binary search narrows the range down to a few keys,
+ *  then the keys left are counted. Probes of the next step are prefetched,
+ *  so the dependent loads of a cold node overlap.
+ *  Contiguous keys (stride 1) are counted with AVX2 or SSE4.2 when the CPU
+ *  has it, chosen by search_init. Strided keys leave half or more of each
+ *  vector unused, so they are counted with plain compares.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <immintrin.h>
+#include "bpt.h"
+#include "file.h"
+
+#define SEARCH_WINDOW           8
+#define SEARCH_VECTOR_WINDOW    16
+#define SEARCH_PREFETCH_KEYS    64      // 8 cache lines
+
+// Count keys <= key
+static int count_le_scalar(const uint64_t *keys, int stride, int count, uint64_t key){
+    int i, n = 0;
+
+    for(i = 0; i < count; i++){
+        n += keys[i * stride] <= key;
+    }
+
+    return n;
+}
+
+// Keys are unsigned : flip the sign bit so the signed compare orders them.
+__attribute__((target("avx2")))
+static int count_le_avx2(const uint64_t *keys, int count, uint64_t key){
+    const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+    __m256i target, greater;
+    int i = 0, n = 0;
+
+    target = _mm256_xor_si256(_mm256_set1_epi64x((long long)key), sign);
+    for(; i + 4 <= count; i += 4){
+        greater = _mm256_cmpgt_epi64(_mm256_xor_si256(
+                    _mm256_loadu_si256((const __m256i*)(keys + i)), sign), target);
+        n += 4 - __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(greater)));
+    }
+    for(; i < count; i++){
+        n += keys[i] <= key;
+    }
+
+    return n;
+}
+
+__attribute__((target("sse4.2")))
+static int count_le_sse42(const uint64_t *keys, int count, uint64_t key){
+    const __m128i sign = _mm_set1_epi64x((long long)0x8000000000000000ULL);
+    __m128i target, greater;
+    int i = 0, n = 0;
+
+    target = _mm_xor_si128(_mm_set1_epi64x((long long)key), sign);
+    for(; i + 2 <= count; i += 2){
+        greater = _mm_cmpgt_epi64(_mm_xor_si128(
+                    _mm_loadu_si128((const __m128i*)(keys + i)), sign), target);
+        n += 2 - __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(greater)));
+    }
+    for(; i < count; i++){
+        n += keys[i] <= key;
+    }
+
+    return n;
+}
+
+// Vector kernel of this CPU, NULL if there is none.
+static int (*count_le_vector)(const uint64_t *keys, int count, uint64_t key) = NULL;
+
+void search_init(void){
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        count_le_vector = count_le_avx2;
+    }
+    else if(__builtin_cpu_supports("sse4.2")){
+        count_le_vector = count_le_sse42;
+    }
+    else{
+        count_le_vector = NULL;
+    }
+}
+
+int search_upper(const uint64_t *keys, int stride, int count, uint64_t key){
+    int base = 0, half, vector, i;
+
+    vector = stride == 1 && count_le_vector != NULL;
+
+    // Few lines of keys (leaf) : fetch them all at once, the node was just pinned.
+    if(count * stride <= SEARCH_PREFETCH_KEYS){
+        for(i = 0; i < count * stride; i += 8){
+            __builtin_prefetch(keys + i);
+        }
+    }
+
+    // Keys before base are <= key, keys from base + count on are > key.
+    while(count > (vector ? SEARCH_VECTOR_WINDOW : SEARCH_WINDOW)){
+        half = count / 2;
+        // Both keys the next step may probe : the loads overlap instead of waiting on each other.
+        __builtin_prefetch(keys + (base + half / 2) * stride);
+        __builtin_prefetch(keys + (base + half + half / 2) * stride);
+        base = keys[(base + half) * stride] <= key ? base + half : base;
+        count -= half;
+    }
+
+    if(vector){
+        return base + count_le_vector(keys + base, count, key);
+    }
+    return base + count_le_scalar(keys + base * stride, stride, count, key);
+}
+
+int search_lower(const uint64_t *keys, int stride, int count, uint64_t key){
+    // Keys < key are the keys <= key - 1.
+    return key == 0 ? 0 : search_upper(keys, stride, count, key - 1);
+}
+
+int search_key(const uint64_t *keys, int stride, int count, uint64_t key){
+    int i;
+
+    i = search_lower(keys, stride, count, key);
+    if(i < count && keys[i * stride] == key){
+        return i;
+    }
+
+    return -1;
+}
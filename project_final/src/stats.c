@@ -0,0 +1,175 @@
+/*
+ *  stats.c
+ *
+ *  Statistics of the buffer manager.
+ *  Counters are kept for the whole engine and for each table,
+ *  and can be read with get_buffer_stats or written as JSON
+ *  with dump_buffer_stats, together with the buffer pool usage.
+ *
+ *  I/O latency is counted per request : one page read or write,
+ *  one write of a run of pages, or one io_uring completion.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "bpt.h"
+#include "file.h"
+
+extern Buffer *buf_mgr;
+extern int buf_size;
+extern int num_free_frames;
+extern int num_buf_segments;
+extern ReplacementPolicy *buf_policy;
+extern int dbfile[STATS_MAX_TABLE];
+
+BufferStats buf_stats[STATS_MAX_TABLE + 1];
+
+uint64_t stats_clock(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void stats_io(int table_id, int write, size_t bytes, uint64_t start){
+    uint64_t us = (stats_clock() - start) / 1000;
+    int bucket = 0;
+
+    // Bucket : number of bits of the latency in us.
+    while(us > 0 && bucket < BUF_STATS_LATENCY_BUCKETS - 1){
+        us >>= 1;
+        bucket++;
+    }
+
+    if(write){
+        STATS_ADD(table_id, bytes_written, bytes);
+        STATS_ADD(table_id, write_latency[bucket], 1);
+    }
+    else{
+        STATS_ADD(table_id, bytes_read, bytes);
+        STATS_ADD(table_id, read_latency[bucket], 1);
+    }
+}
+
+// Counters are read one by one : I/O of the background writer may count at the same time.
+static void copy_stats(BufferStats *dest, BufferStats *src){
+    uint64_t *to = (uint64_t *)dest, *from = (uint64_t *)src;
+    size_t i;
+
+    for(i = 0; i < sizeof(BufferStats) / sizeof(uint64_t); i++){
+        to[i] = __atomic_load_n(from + i, __ATOMIC_RELAXED);
+    }
+}
+
+int get_buffer_stats(int table_id, BufferStats *stats){
+    // Failure case
+    if(table_id < 0 || table_id > STATS_MAX_TABLE || stats == NULL){
+        return -1;
+    }
+
+    copy_stats(stats, &buf_stats[table_id]);
+
+    return 0;
+}
+
+int reset_buffer_stats(){
+    uint64_t *counter = (uint64_t *)buf_stats;
+    size_t i;
+
+    for(i = 0; i < (sizeof(buf_stats) / sizeof(buf_stats[0])) * (sizeof(BufferStats) / sizeof(uint64_t)); i++){
+        __atomic_store_n(counter + i, 0, __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+static void print_histogram(FILE *out, const char *name, uint64_t *buckets){
+    int i;
+
+    fprintf(out, "\"%s\": [", name);
+    for(i = 0; i < BUF_STATS_LATENCY_BUCKETS; i++){
+        fprintf(out, "%s%" PRIu64, i == 0 ? "" : ", ", buckets[i]);
+    }
+    fprintf(out, "]");
+}
+
+static void print_stats(FILE *out, BufferStats *stats, int resident, int dirty){
+    uint64_t lookups = stats->hits + stats->misses;
+
+    fprintf(out, "{\"hits\": %" PRIu64 ", \"misses\": %" PRIu64 ", \"hit_ratio\": %.4f, ",
+            stats->hits, stats->misses, lookups == 0 ? 0.0 : (double)stats->hits / lookups);
+    fprintf(out, "\"evictions\": %" PRIu64 ", \"dirty_evictions\": %" PRIu64 ", ",
+            stats->evictions, stats->dirty_evictions);
+    fprintf(out, "\"bytes_read\": %" PRIu64 ", \"bytes_written\": %" PRIu64 ", ",
+            stats->bytes_read, stats->bytes_written);
+    fprintf(out, "\"resident_pages\": %d, \"dirty_pages\": %d, ", resident, dirty);
+    print_histogram(out, "read_latency_us", stats->read_latency);
+    fprintf(out, ", ");
+    print_histogram(out, "write_latency_us", stats->write_latency);
+    fprintf(out, "}");
+}
+
+int dump_buffer_stats(const char *pathname){
+    BufferStats stats;
+    FILE *out = stdout;
+    int i, resident[STATS_MAX_TABLE + 1] = {0,}, dirty[STATS_MAX_TABLE + 1] = {0,}, first = 1;
+
+    if(pathname != NULL){
+        out = fopen(pathname, "w");
+        if(out == NULL){
+            return -1;
+        }
+    }
+
+    engine_lock();
+
+    // Buffer pool usage : pages of each table in the frames.
+    for(i = 0; buf_mgr != NULL && i < buf_size; i++){
+        if(buf_mgr[i].table_id < 1){
+            continue;
+        }
+        resident[0]++;
+        resident[buf_mgr[i].table_id]++;
+        if(buf_mgr[i].is_dirty == 1){
+            dirty[0]++;
+            dirty[buf_mgr[i].table_id]++;
+        }
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"buffer\": {\"frames\": %d, \"free_frames\": %d, \"segments\": %d, \"policy\": \"%s\"},\n",
+            buf_mgr == NULL ? 0 : buf_size, num_free_frames, num_buf_segments,
+            buf_policy == NULL ? "" : buf_policy->name);
+    fprintf(out, "  \"warm_start\": {\"time_us\": %" PRIu64 ", \"loaded_pages\": %" PRIu64 "},\n",
+            warm_time_us, warm_loaded_pages);
+
+    copy_stats(&stats, &buf_stats[0]);
+    fprintf(out, "  \"global\": ");
+    print_stats(out, &stats, resident[0], dirty[0]);
+    fprintf(out, ",\n  \"clock_sweeps\": %" PRIu64 ", \"sweeps_per_eviction\": %.2f, \"wal_flushes\": %" PRIu64 ",\n",
+            stats.clock_sweeps, stats.evictions == 0 ? 0.0 : (double)stats.clock_sweeps / stats.evictions,
+            stats.wal_flushes);
+
+    // Tables : open ones and the ones with counters.
+    fprintf(out, "  \"tables\": {");
+    for(i = 1; i <= STATS_MAX_TABLE; i++){
+        copy_stats(&stats, &buf_stats[i]);
+        if(dbfile[i - 1] <= 0 && stats.hits + stats.misses + stats.bytes_read + stats.bytes_written == 0){
+            continue;
+        }
+        fprintf(out, "%s\n    \"%d\": ", first ? "" : ",", i);
+        print_stats(out, &stats, resident[i], dirty[i]);
+        first = 0;
+    }
+    fprintf(out, "%s}\n}\n", first ? "" : "\n  ");
+
+    engine_unlock();
+
+    if(out != stdout){
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ *  uring.c
+ *
+ *  Asynchronous page I/O of the buffer manager.
+ *  Batches of page reads and writes are submitted together through
+ *  io_uring, so more than one I/O is in flight at a time.
+ *  The ring is set up with raw system calls (no liburing).
+ *  Each thread gets its own ring : the background writer does I/O
+ *  without the engine latch.
+ *
+ *  Without io_uring (old kernel, seccomp), batches fall back to
+ *  load_page / flush_page one page at a time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "bpt.h"
+#include "file.h"
+
+extern int dbfile[10];
+
+typedef struct _Uring {
+    int fd;
+    // Submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    // Mappings
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    // Aligned pages for direct I/O : one per queue entry
+    char *bounce;
+} Uring;
+
+static __thread Uring *thread_ring = NULL;
+// Set when io_uring can't be used : stay on the fallback.
+static __thread int thread_ring_failed = 0;
+
+static void destroy_ring(Uring *ring){
+    if(ring->bounce != NULL){
+        munmap(ring->bounce, PAGE_IO_QUEUE_DEPTH * PAGE_SIZE);
+    }
+    if(ring->sqes != NULL){
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if(ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring){
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if(ring->sq_ring != NULL){
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if(ring->fd >= 0){
+        close(ring->fd);
+    }
+    free(ring);
+}
+
+static Uring* setup_ring(void){
+    struct io_uring_params params;
+    Uring *ring;
+    char *sq, *cq;
+
+    ring = (Uring*)calloc(1, sizeof(Uring));
+    if(ring == NULL){
+        return NULL;
+    }
+
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, PAGE_IO_QUEUE_DEPTH, &params);
+    if(ring->fd < 0){
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // Both queues in one mapping when the kernel allows it.
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(ring->cq_ring_size > ring->sq_ring_size){
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED){
+        ring->sq_ring = NULL;
+        destroy_ring(ring);
+        return NULL;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        ring->cq_ring = ring->sq_ring;
+    }
+    else{
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ring == MAP_FAILED){
+            ring->cq_ring = NULL;
+            destroy_ring(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED){
+        ring->sqes = NULL;
+        destroy_ring(ring);
+        return NULL;
+    }
+
+    ring->bounce = mmap(NULL, PAGE_IO_QUEUE_DEPTH * PAGE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring->bounce == MAP_FAILED){
+        ring->bounce = NULL;
+        destroy_ring(ring);
+        return NULL;
+    }
+
+    sq = (char*)ring->sq_ring;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+    cq = (char*)ring->cq_ring;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return ring;
+}
+
+static Uring* get_ring(void){
+    if(thread_ring == NULL && !thread_ring_failed){
+        thread_ring = setup_ring();
+        if(thread_ring == NULL){
+            thread_ring_failed = 1;
+        }
+    }
+    return thread_ring;
+}
+
+// Submit one batch (at most PAGE_IO_QUEUE_DEPTH pages) and wait for all of it.
+// Pages whose request failed are done again with the fallback.
+static void submit_batch(Uring *ring, PageIO *ios, int count, int write){
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    unsigned tail, head;
+    int i, done = 0, res, unsupported = 0;
+    uint64_t start = stats_clock();
+    PageIO *io;
+
+    tail = *ring->sq_tail;
+    for(i = 0; i < count; i++){
+        sqe = &ring->sqes[tail & *ring->sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+
+        io = ios + i;
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd = dbfile[io->table_id - 1];
+        sqe->off = write ? io->page->file_offset : io->offset;
+        sqe->len = PAGE_SIZE;
+        sqe->user_data = i;
+        // Frames are not aligned : direct I/O uses the bounce pages.
+        if(direct_io){
+            if(write){
+                memcpy(ring->bounce + i * PAGE_SIZE, io->page, PAGE_SIZE);
+            }
+            sqe->addr = (uint64_t)(uintptr_t)(ring->bounce + i * PAGE_SIZE);
+        }
+        else{
+            sqe->addr = (uint64_t)(uintptr_t)io->page;
+        }
+
+        ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+        tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    if(syscall(__NR_io_uring_enter, ring->fd, count, count, IORING_ENTER_GETEVENTS, NULL, 0) < 0){
+        // Ring is not usable : drop it and do the whole batch with the fallback.
+        page_io_destroy();
+        thread_ring_failed = 1;
+        for(i = 0; i < count; i++){
+            if(write){
+                flush_page(ios[i].table_id, ios[i].page);
+            }
+            else{
+                load_page(ios[i].table_id, ios[i].offset, ios[i].page);
+            }
+        }
+        return;
+    }
+
+    while(done < count){
+        head = *ring->cq_head;
+        if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)){
+            syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            continue;
+        }
+        cqe = &ring->cqes[head & *ring->cq_mask];
+        i = (int)cqe->user_data;
+        res = cqe->res;
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+        done++;
+
+        io = ios + i;
+        // Case : request failed. Do it again with the fallback.
+        if(res < 0){
+            // Opcode not supported by this kernel : stop using the ring after this batch.
+            if(res == -EINVAL){
+                unsupported = 1;
+            }
+            if(write){
+                flush_page(io->table_id, io->page);
+            }
+            else{
+                load_page(io->table_id, io->offset, io->page);
+            }
+            continue;
+        }
+        if(!write){
+            // Page past the end of file : keep the page as it is, like read.
+            if(direct_io && res > 0){
+                memcpy(io->page, ring->bounce + i * PAGE_SIZE, res);
+            }
+            io->page->file_offset = io->offset;
+        }
+        stats_io(io->table_id, write, PAGE_SIZE, start);
+    }
+
+    if(unsupported){
+        page_io_destroy();
+        thread_ring_failed = 1;
+    }
+}
+
+void load_pages(PageIO *ios, int count){
+    Uring *ring = get_ring();
+    int i, n;
+
+    // Case : single page or no io_uring.
+    if(ring == NULL || count == 1){
+        for(i = 0; i < count; i++){
+            load_page(ios[i].table_id, ios[i].offset, ios[i].page);
+        }
+        return;
+    }
+
+    for(i = 0; i < count; i += n){
+        n = count - i < PAGE_IO_QUEUE_DEPTH ? count - i : PAGE_IO_QUEUE_DEPTH;
+        submit_batch(ring, ios + i, n, 0);
+    }
+}
+
+void flush_pages(PageIO *ios, int count){
+    Uring *ring = get_ring();
+    int i, n;
+
+    // Case : single page or no io_uring.
+    if(ring == NULL || count == 1){
+        for(i = 0; i < count; i++){
+            flush_page(ios[i].table_id, ios[i].page);
+        }
+        return;
+    }
+
+    for(i = 0; i < count; i += n){
+        n = count - i < PAGE_IO_QUEUE_DEPTH ? count - i : PAGE_IO_QUEUE_DEPTH;
+        submit_batch(ring, ios + i, n, 1);
+    }
+}
+
+void page_io_destroy(void){
+    if(thread_ring != NULL){
+        destroy_ring(thread_ring);
+        thread_ring = NULL;
+    }
+    thread_ring_failed = 0;
+}
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include "bpt.h"
+#include "file.h"
+#include <string.h>
+
+// Fault test : init_db and resize_buffer with one allocation failing at a time.
+// A failed call must leave nothing allocated (init_db) or the pool unchanged (resize_buffer).
+// Linked with malloc, calloc, realloc and free wrapped (-Wl,--wrap).
+// Run from an empty directory : data files are created there.
+
+#define NUM_KEYS        2000
+
+extern int buf_size;
+extern int num_buf_segments;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static int failures = 0;
+// Allocations left before the failing one, -1 to never fail.
+static int fail_after = -1;
+// Blocks allocated and not freed yet.
+static long live_blocks = 0;
+
+static int fail_now(void){
+    if(fail_after < 0){
+        return 0;
+    }
+    return fail_after-- == 0;
+}
+void *__wrap_malloc(size_t size){
+    void *ptr;
+
+    if(fail_now()){
+        return NULL;
+    }
+    ptr = __real_malloc(size);
+    live_blocks += ptr != NULL;
+    return ptr;
+}
+void *__wrap_calloc(size_t count, size_t size){
+    void *ptr;
+
+    if(fail_now()){
+        return NULL;
+    }
+    ptr = __real_calloc(count, size);
+    live_blocks += ptr != NULL;
+    return ptr;
+}
+void *__wrap_realloc(void *ptr, size_t size){
+    void *new_ptr;
+
+    if(fail_now()){
+        return NULL;
+    }
+    new_ptr = __real_realloc(ptr, size);
+    live_blocks += ptr == NULL && new_ptr != NULL;
+    return new_ptr;
+}
+void __wrap_free(void *ptr){
+    live_blocks -= ptr != NULL;
+    __real_free(ptr);
+}
+
+static void reset_files(void){
+    unlink("DATA1");
+    unlink("log.db");
+}
+
+static void check_keys(const char *test, int policy, int table_id){
+    char *value;
+    uint64_t key;
+
+    for(key = 0; key < NUM_KEYS; key++){
+        value = find(table_id, key);
+        if(value == NULL){
+            printf("%s (policy %d) : key %" PRIu64 " is missing\n", test, policy, key);
+            failures++;
+            return;
+        }
+        free(value);
+    }
+}
+
+/* A failed init_db releases everything it allocated, and the next one works. */
+static void test_init(int policy){
+    long before;
+    int k, result;
+
+    for(k = 0; ; k++){
+        before = live_blocks;
+        fail_after = k;
+        result = init_db_policy(64, policy);
+        fail_after = -1;
+        if(result == 0){
+            shutdown_db();
+            break;
+        }
+        if(live_blocks != before || num_buf_segments != 0 || buf_size != -1){
+            printf("init (policy %d) : allocation %d failed, %ld blocks and %d segments left\n",
+                    policy, k, live_blocks - before, num_buf_segments);
+            failures++;
+        }
+    }
+}
+
+/* A failed resize leaves the pool as it was and usable. */
+static void test_resize(int policy, int num_buf){
+    char value[SIZE_VALUE] = "value";
+    uint64_t key;
+    int k, result, table_id;
+
+    reset_files();
+    init_db_policy(64, policy);
+    table_id = open_table("DATA1");
+    for(key = 0; key < NUM_KEYS; key++){
+        insert(table_id, key, value);
+    }
+
+    for(k = 0; ; k++){
+        fail_after = k;
+        result = resize_buffer(num_buf);
+        fail_after = -1;
+        if(result == 0){
+            break;
+        }
+        if(buf_size != 64){
+            printf("resize to %d (policy %d) : allocation %d failed, pool has %d frames\n",
+                    num_buf, policy, k, buf_size);
+            failures++;
+        }
+        check_keys("resize", policy, table_id);
+    }
+    if(buf_size != num_buf){
+        printf("resize to %d (policy %d) : pool has %d frames\n", num_buf, policy, buf_size);
+        failures++;
+    }
+    check_keys("resize", policy, table_id);
+    shutdown_db();
+}
+
+// MAIN
+int main( void ) {
+    int policy;
+
+    for(policy = BUF_POLICY_CLOCK; policy <= BUF_POLICY_ARC; policy++){
+        test_init(policy);
+        test_resize(policy, 16);
+        test_resize(policy, 256);
+    }
+    reset_files();
+
+    if(failures > 0){
+        printf("fault_test : %d failures\n", failures);
+        return 1;
+    }
+    printf("fault_test : ok\n");
+    return 0;
+}
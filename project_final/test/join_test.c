@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include "bpt.h"
+#include "file.h"
+#include <string.h>
+
+// Join test : joins with an empty table produce no rows.
+// Run from an empty directory : data files and the result file are created there.
+
+static int failures = 0;
+
+static void reset_files(void){
+    unlink("DATA1");
+    unlink("DATA2");
+    unlink("log.db");
+    unlink("result.txt");
+}
+
+// Join the tables and compare the number of result rows with expected.
+static void check_join(const char *test, int table_id_1, int table_id_2, int expected){
+    FILE *fp;
+    char line[512];
+    int rows = 0;
+
+    if(join_table(table_id_1, table_id_2, "result.txt") != 0){
+        printf("%s : join_table failed\n", test);
+        failures++;
+        return;
+    }
+    fp = fopen("result.txt", "r");
+    if(fp != NULL){
+        while(fgets(line, sizeof(line), fp) != NULL){
+            rows++;
+        }
+        fclose(fp);
+    }
+    if(rows != expected){
+        printf("%s : %d rows, expected %d\n", test, rows, expected);
+        failures++;
+    }
+}
+
+/* Two empty tables, an empty table and a table holding key 0, a table emptied by delete. */
+static void test_empty_tables(void){
+    char value[SIZE_VALUE] = "value";
+    uint64_t key;
+    int table_1, table_2;
+
+    reset_files();
+    init_db(100);
+    table_1 = open_table("DATA1");
+    table_2 = open_table("DATA2");
+    check_join("both_empty", table_1, table_2, 0);
+
+    insert(table_2, 0, value);
+    check_join("empty_and_key_0", table_1, table_2, 0);
+    check_join("key_0_and_empty", table_2, table_1, 0);
+
+    for(key = 1; key <= 100; key++){
+        insert(table_1, key, value);
+    }
+    insert(table_2, 50, value);
+    check_join("overlap", table_1, table_2, 1);
+
+    for(key = 1; key <= 100; key++){
+        delete(table_1, key);
+    }
+    check_join("emptied_by_delete", table_1, table_2, 0);
+    check_join("emptied_by_delete_reversed", table_2, table_1, 0);
+    shutdown_db();
+}
+
+// MAIN
+int main( void ) {
+    test_empty_tables();
+    reset_files();
+
+    if(failures > 0){
+        printf("join_test : %d failures\n", failures);
+        return 1;
+    }
+    printf("join_test : ok\n");
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include "bpt.h"
+#include "file.h"
+#include <string.h>
+
+// Reopen test : values must survive shutdown_db and init_db.
+// Run from an empty directory : data files and log.db are created there.
+
+static int failures = 0;
+
+static void reset_files(void){
+    unlink("DATA1");
+    unlink("log.db");
+}
+
+// Compare the value of key with expected, NULL for a deleted key.
+static void check(const char *test, int table_id, uint64_t key, const char *expected){
+    char *value;
+
+    value = find(table_id, key);
+    if(expected == NULL && value != NULL){
+        printf("%s : key %" PRIu64 " should be deleted, found %s\n", test, key, value);
+        failures++;
+    }
+    if(expected != NULL && (value == NULL || strcmp(value, expected) != 0)){
+        printf("%s : key %" PRIu64 " is %s, expected %s\n", test, key, value == NULL ? "(none)" : value, expected);
+        failures++;
+    }
+    free(value);
+}
+
+// Values are passed in SIZE_VALUE buffers : insert and update copy SIZE_VALUE bytes.
+static void value_of(uint64_t key, char *value){
+    memset(value, 0, SIZE_VALUE);
+    snprintf(value, SIZE_VALUE, "v%" PRIu64, key);
+}
+
+/* An update, then records moved by a delete : the update must not land on a neighbor. */
+static void test_update_then_delete(void){
+    char value[SIZE_VALUE];
+    uint64_t key;
+    int table_id;
+
+    reset_files();
+    init_db(100);
+    table_id = open_table("DATA1");
+    for(key = 1; key <= 10; key++){
+        value_of(key, value);
+        insert(table_id, key, value);
+    }
+    strcpy(value, "UPDATED");
+    update(table_id, 5, value);
+    delete(table_id, 3);
+    shutdown_db();
+
+    if(access("log.db", F_OK) == 0){
+        printf("update_then_delete : log.db left after a clean shutdown\n");
+        failures++;
+    }
+
+    init_db(100);
+    table_id = open_table("DATA1");
+    for(key = 1; key <= 10; key++){
+        value_of(key, value);
+        check("update_then_delete", table_id, key, key == 3 ? NULL : key == 5 ? "UPDATED" : value);
+    }
+    shutdown_db();
+}
+
+/* Same through close_table, and a committed transaction followed by inserts. */
+static void test_close_table(void){
+    char value[SIZE_VALUE];
+    uint64_t key;
+    int table_id;
+
+    reset_files();
+    init_db(4);
+    table_id = open_table("DATA1");
+    for(key = 2; key <= 200; key += 2){
+        value_of(key, value);
+        insert(table_id, key, value);
+    }
+    begin_transaction();
+    strcpy(value, "COMMITTED");
+    update(table_id, 100, value);
+    commit_transaction();
+    // Odd keys shift every record of the leaves after the update.
+    for(key = 1; key <= 199; key += 2){
+        value_of(key, value);
+        insert(table_id, key, value);
+    }
+    close_table(table_id);
+    shutdown_db();
+
+    init_db(4);
+    table_id = open_table("DATA1");
+    for(key = 1; key <= 200; key++){
+        value_of(key, value);
+        check("close_table", table_id, key, key == 100 ? "COMMITTED" : value);
+    }
+    shutdown_db();
+}
+
+// MAIN
+int main( void ) {
+    test_update_then_delete();
+    test_close_table();
+    reset_files();
+
+    if(failures > 0){
+        printf("reopen_test : %d failures\n", failures);
+        return 1;
+    }
+    printf("reopen_test : ok\n");
+    return 0;
+}
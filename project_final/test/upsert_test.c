@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include "bpt.h"
+#include "file.h"
+#include <string.h>
+
+// Upsert test : logged upserts mixed with inserts and deletes that move records,
+// then shutdown_db and init_db. Every value is checked against a reference copy.
+// Run from an empty directory : data files and log.db are created there.
+
+#define NUM_KEYS        2000
+#define NUM_OPS         40000
+#define NUM_BUF         16
+
+static int failures = 0;
+// Reference : version of each key, 0 if the key is not in the table.
+static int version[NUM_KEYS];
+
+static void reset_files(void){
+    unlink("DATA1");
+    unlink("log.db");
+}
+
+// Values are passed in SIZE_VALUE buffers : insert and upsert copy SIZE_VALUE bytes.
+static void value_of(uint64_t key, int ver, char *value){
+    memset(value, 0, SIZE_VALUE);
+    snprintf(value, SIZE_VALUE, "k%" PRIu64 "_v%d", key, ver);
+}
+
+// Compare every key of the table with the reference.
+static void check_all(const char *test, int policy, int table_id){
+    char expected[SIZE_VALUE], *value;
+    uint64_t key;
+
+    for(key = 0; key < NUM_KEYS; key++){
+        value = find(table_id, key);
+        if(version[key] == 0 && value != NULL){
+            printf("%s (policy %d) : key %" PRIu64 " should be deleted, found %s\n", test, policy, key, value);
+            failures++;
+        }
+        if(version[key] != 0){
+            value_of(key, version[key], expected);
+            if(value == NULL || strcmp(value, expected) != 0){
+                printf("%s (policy %d) : key %" PRIu64 " is %s, expected %s\n",
+                        test, policy, key, value == NULL ? "(none)" : value, expected);
+                failures++;
+            }
+        }
+        free(value);
+    }
+}
+
+static void test_upsert_reopen(int policy){
+    char value[SIZE_VALUE];
+    uint64_t key;
+    int i, op, table_id;
+
+    reset_files();
+    memset(version, 0, sizeof(version));
+    srand(policy + 1);
+
+    init_db_policy(NUM_BUF, policy);
+    table_id = open_table("DATA1");
+    for(i = 0; i < NUM_OPS; i++){
+        key = rand() % NUM_KEYS;
+        op = rand() % 4;
+
+        // Case : upsert, half of the time.
+        if(op < 2){
+            value_of(key, version[key] + 1, value);
+            if(upsert(table_id, key, value) == 0){
+                version[key]++;
+            }
+        }
+        // Case : insert of a missing key moves the records after it.
+        else if(op == 2 && version[key] == 0){
+            value_of(key, 1, value);
+            if(insert(table_id, key, value) == 0){
+                version[key] = 1;
+            }
+        }
+        // Case : delete moves the records after it back.
+        else if(op == 3 && version[key] != 0){
+            if(delete(table_id, key) == 0){
+                version[key] = 0;
+            }
+        }
+    }
+    check_all("before_reopen", policy, table_id);
+    shutdown_db();
+
+    init_db_policy(NUM_BUF, policy);
+    table_id = open_table("DATA1");
+    check_all("after_reopen", policy, table_id);
+    shutdown_db();
+}
+
+// MAIN
+int main( void ) {
+    int policy;
+
+    for(policy = BUF_POLICY_CLOCK; policy <= BUF_POLICY_ARC; policy++){
+        test_upsert_reopen(policy);
+    }
+    reset_files();
+
+    if(failures > 0){
+        printf("upsert_test : %d failures\n", failures);
+        return 1;
+    }
+    printf("upsert_test : ok\n");
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include "bpt.h"
+#include "file.h"
+#include <string.h>
+
+// Warm start test : the resident page list is opt-in and names data files, not table ids.
+// Run from an empty directory : data files and lists are created there.
+
+#define NUM_KEYS        5000
+
+static int failures = 0;
+
+static void reset_files(void){
+    unlink("DATA1");
+    unlink("DATA1.old");
+    unlink("log.db");
+    unlink("buffer.warm");
+    unlink("db.warm");
+}
+
+// Open DATA1 in a fresh engine and return the number of pages preloaded.
+static uint64_t reopen_warm(void){
+    uint64_t before;
+
+    init_db(100);
+    before = warm_loaded_pages;
+    open_table("DATA1");
+    return warm_loaded_pages - before;
+}
+
+static void fill_table(void){
+    char value[SIZE_VALUE] = "value";
+    uint64_t key;
+    int table_id;
+
+    init_db(100);
+    table_id = open_table("DATA1");
+    for(key = 0; key < NUM_KEYS; key++){
+        insert(table_id, key, value);
+    }
+    shutdown_db();
+}
+
+/* Without set_warm_file, nothing is written and nothing is preloaded. */
+static void test_off_by_default(void){
+    reset_files();
+    fill_table();
+    if(access("buffer.warm", F_OK) == 0 || access("db.warm", F_OK) == 0){
+        printf("off_by_default : a list was written\n");
+        failures++;
+    }
+    if(reopen_warm() != 0){
+        printf("off_by_default : pages were preloaded\n");
+        failures++;
+    }
+    shutdown_db();
+}
+
+/* With a list, the next start preloads the table. A new file under the same name does not match. */
+static void test_warm_file(void){
+    uint64_t loaded;
+
+    reset_files();
+    set_warm_file("db.warm");
+    fill_table();
+    if(access("db.warm", F_OK) != 0){
+        printf("warm_file : db.warm was not written\n");
+        failures++;
+    }
+    loaded = reopen_warm();
+    if(loaded == 0){
+        printf("warm_file : no page preloaded\n");
+        failures++;
+    }
+    shutdown_db();
+
+    // Another DATA1 of the same size : same table id, different file.
+    rename("DATA1", "DATA1.old");
+    set_warm_file(NULL);
+    fill_table();
+    set_warm_file("db.warm");
+    loaded = reopen_warm();
+    if(loaded != 0){
+        printf("warm_file : %" PRIu64 " pages of another file preloaded\n", loaded);
+        failures++;
+    }
+    shutdown_db();
+    set_warm_file(NULL);
+}
+
+// MAIN
+int main( void ) {
+    test_off_by_default();
+    test_warm_file();
+    reset_files();
+
+    if(failures > 0){
+        printf("warm_test : %d failures\n", failures);
+        return 1;
+    }
+    printf("warm_test : ok\n");
+    return 0;
+}